@@ -0,0 +1,261 @@
+/**
+ * ERU: A simple, lightweight, portable text editor for POSIX systems.
+ *
+ * Copyright (C) 2021, Eric Londo <londoed@comcast.net>, { arena.c }.
+ * This software is distributed under the GNU General Public License Version 2.0.
+ * Refer to the file LICENSE for additional details.
+**/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ARENA_HDR sizeof(size_t)
+#define ARENA_CLASS_SIZE(c) ((size_t)1 << ((c) + ARENA_MIN_SHIFT))
+
+void
+arena_init(struct Arena *a)
+{
+	memset(a, 0, sizeof(struct Arena));
+}
+
+void
+arena_release(struct Arena *a)
+{
+	while (a->slabs) {
+		struct ArenaSlab *next = a->slabs->next;
+
+		free(a->slabs);
+		a->slabs = next;
+	}
+
+	while (a->large) {
+		struct ArenaLarge *next = a->large->next;
+
+		free(a->large);
+		a->large = next;
+	}
+
+	arena_init(a);
+}
+
+static int
+arena_class(size_t n)
+{
+	int c = 0;
+
+	while (c < ARENA_CLASSES && ARENA_CLASS_SIZE(c) < n)
+		c++;
+
+	return c;
+}
+
+static void *
+arena_take(struct Arena *a, int c)
+{
+	void *p;
+
+	if (a->free_list[c]) {
+		p = a->free_list[c];
+		a->free_list[c] = a->free_list[c]->next;
+		a->reuses++;
+	} else {
+		size_t size = ARENA_CLASS_SIZE(c);
+
+		if (a->slabs == NULL || ARENA_SLAB - a->slabs->used < size) {
+			struct ArenaSlab *slab = malloc(sizeof(struct ArenaSlab) + ARENA_SLAB);
+
+			if (slab == NULL)
+				return NULL;
+
+			slab->used = 0;
+			slab->next = a->slabs;
+			a->slabs = slab;
+			a->num_slabs++;
+		}
+
+		p = &a->slabs->data[a->slabs->used];
+		a->slabs->used += size;
+	}
+
+	a->live[c]++;
+
+	return p;
+}
+
+static void
+arena_give(struct Arena *a, void *p, int c)
+{
+	struct ArenaFree *f = p;
+
+	f->next = a->free_list[c];
+	a->free_list[c] = f;
+	a->live[c]--;
+}
+
+static void *
+arena_alloc_large(struct Arena *a, size_t n)
+{
+	struct ArenaLarge *l = malloc(sizeof(struct ArenaLarge) + ARENA_HDR + n);
+
+	if (l == NULL)
+		return NULL;
+
+	l->size = n;
+	l->prev = NULL;
+	l->next = a->large;
+
+	if (a->large)
+		a->large->prev = l;
+
+	a->large = l;
+	a->num_large++;
+	a->large_bytes += n;
+
+	size_t *hdr = (size_t *)(l + 1);
+	*hdr = ARENA_CLASSES;
+
+	return hdr + 1;
+}
+
+void *
+arena_alloc(struct Arena *a, size_t n)
+{
+	int c = arena_class(n + ARENA_HDR);
+
+	a->allocs++;
+
+	if (c == ARENA_CLASSES)
+		return arena_alloc_large(a, n);
+
+	size_t *hdr = arena_take(a, c);
+
+	if (hdr == NULL)
+		return NULL;
+
+	*hdr = c;
+
+	return hdr + 1;
+}
+
+void
+arena_free(struct Arena *a, void *p)
+{
+	if (p == NULL)
+		return;
+
+	size_t *hdr = (size_t *)p - 1;
+	size_t c = *hdr;
+
+	a->frees++;
+
+	if (c == ARENA_CLASSES) {
+		struct ArenaLarge *l = (struct ArenaLarge *)hdr - 1;
+
+		if (l->prev)
+			l->prev->next = l->next;
+		else
+			a->large = l->next;
+
+		if (l->next)
+			l->next->prev = l->prev;
+
+		a->num_large--;
+		a->large_bytes -= l->size;
+		free(l);
+
+		return;
+	}
+
+	arena_give(a, hdr, c);
+}
+
+void *
+arena_alloc_sized(struct Arena *a, size_t n)
+{
+	int c = arena_class(n);
+
+	if (c == ARENA_CLASSES)
+		return arena_alloc(a, n);
+
+	a->allocs++;
+
+	return arena_take(a, c);
+}
+
+void
+arena_free_sized(struct Arena *a, void *p, size_t n)
+{
+	int c = arena_class(n);
+
+	if (p == NULL)
+		return;
+
+	if (c == ARENA_CLASSES) {
+		arena_free(a, p);
+		return;
+	}
+
+	a->frees++;
+	arena_give(a, p, c);
+}
+
+/**
+ * Growing a large block takes half as much again, so a buffer that grows
+ * a little at a time is copied a logarithmic number of times.
+**/
+void *
+arena_realloc(struct Arena *a, void *p, size_t n)
+{
+	if (p == NULL)
+		return arena_alloc(a, n);
+
+	size_t *hdr = (size_t *)p - 1;
+	size_t have;
+
+	if (*hdr == ARENA_CLASSES)
+		have = ((struct ArenaLarge *)hdr - 1)->size;
+	else
+		have = ARENA_CLASS_SIZE(*hdr) - ARENA_HDR;
+
+	if (n <= have)
+		return p;
+
+	if (*hdr == ARENA_CLASSES && n < have + have / 2)
+		n = have + have / 2;
+
+	void *q = arena_alloc(a, n);
+
+	if (q == NULL)
+		return NULL;
+
+	memcpy(q, p, have);
+	arena_free(a, p);
+
+	return q;
+}
+
+void
+arena_report(const struct Arena *a, FILE *fp)
+{
+	size_t live = 0, live_bytes = 0;
+	int c;
+
+	for (c = 0; c < ARENA_CLASSES; c++) {
+		live += a->live[c];
+		live_bytes += a->live[c] * ARENA_CLASS_SIZE(c);
+	}
+
+	fprintf(fp, "eru: arena: %zu allocations, %zu frees, %zu reused from free lists\n",
+		a->allocs, a->frees, a->reuses);
+	fprintf(fp, "eru: arena: %zu slabs (%zu KB) hold %zu live objects (%zu KB)\n",
+		a->num_slabs, a->num_slabs * ARENA_SLAB / 1024, live, live_bytes / 1024);
+	fprintf(fp, "eru: arena: %zu large objects (%zu KB) outside the slabs\n",
+		a->num_large, a->large_bytes / 1024);
+
+	for (c = 0; c < ARENA_CLASSES; c++) {
+		if (a->live[c])
+			fprintf(fp, "eru: arena:   %5zu bytes: %zu live\n", ARENA_CLASS_SIZE(c), a->live[c]);
+	}
+}
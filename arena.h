@@ -0,0 +1,62 @@
+/**
+ * ERU: A simple, lightweight, portable text editor for POSIX systems.
+ *
+ * Copyright (C) 2021, Eric Londo <londoed@comcast.net>, { arena.h }.
+ * This software is distributed under the GNU General Public License Version 2.0.
+ * Refer to the file LICENSE for additional details.
+**/
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#define ARENA_SLAB (64 * 1024)
+#define ARENA_MIN_SHIFT 4
+#define ARENA_CLASSES 10
+
+/**
+ * Size-class allocator for per-row buffers. Objects of 16 to 8192 bytes,
+ * header included, are bump-allocated out of shared 64 KB slabs and
+ * recycled through one free list per class. Anything larger gets its own
+ * malloc but is still tracked, so arena_release() frees it all at once.
+ *
+ * Fixed-size objects whose size the caller knows at free time can skip
+ * the header with arena_alloc_sized() and arena_free_sized().
+**/
+struct ArenaFree {
+	struct ArenaFree *next;
+};
+
+struct ArenaSlab {
+	struct ArenaSlab *next;
+	size_t used;
+	char data[];
+};
+
+struct ArenaLarge {
+	struct ArenaLarge *prev, *next;
+	size_t size;
+};
+
+struct Arena {
+	struct ArenaSlab *slabs;
+	struct ArenaFree *free_list[ARENA_CLASSES];
+	struct ArenaLarge *large;
+	size_t live[ARENA_CLASSES];
+	size_t num_slabs;
+	size_t num_large, large_bytes;
+	size_t allocs, frees, reuses;
+};
+
+void arena_init(struct Arena *);
+void arena_release(struct Arena *);
+void *arena_alloc(struct Arena *, size_t);
+void *arena_realloc(struct Arena *, void *, size_t);
+void arena_free(struct Arena *, void *);
+void *arena_alloc_sized(struct Arena *, size_t);
+void arena_free_sized(struct Arena *, void *, size_t);
+void arena_report(const struct Arena *, FILE *);
+
+#endif
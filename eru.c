@@ -22,6 +22,10 @@
 #include <time.h>
 #include <termios.h>
 #include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
 #include "eru.h"
 
@@ -38,7 +42,7 @@ char *c_hl_keywords[] = {
 };
 
 struct Syntax hldb[] = {
-	{ "c", c_hl_exts, c_hl_keywords, "//", "/*", "*/", HIGHLIGHT_NUMBERS | HIGHLIGHT_STRINGS },
+	{ "c", c_hl_exts, "//", "/*", "*/", c_hl_keywords, HIGHLIGHT_NUMBERS | HIGHLIGHT_STRINGS, NULL },
 };
 
 void
@@ -51,9 +55,39 @@ eru_error(const char *s)
 	exit(1);
 }
 
+/**
+ * Write all len bytes of buf to the terminal, carrying on after short
+ * writes and interrupts.
+**/
+static int
+eru_write_all(const char *buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = write(STDOUT_FILENO, buf, len);
+
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/**
+ * Also runs from atexit(), after eru_error(), so a failed write is left
+ * alone rather than reported.
+**/
 void
 disable_raw_mode(void)
 {
+	eru_write_all("\x1b[?2004l", 8);
+
 	if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &eru.orig) == -1)
 		eru_error("[!] ERROR: eru: ");
 }
@@ -79,6 +113,9 @@ enable_raw_mode(void)
 
 	if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1)
 		eru_error("[!] ERROR: eru: ");
+
+	if (eru_write_all("\x1b[?2004h", 8) == -1)
+		eru_error("[!] ERROR: eru: ");
 }
 
 /*void eru_info(void)
@@ -92,29 +129,86 @@ enable_raw_mode(void)
 void
 eru_open(char *filename)
 {
+	eru_close();
 	free(eru.filename);
 	eru.filename = strdup(filename);
-	eru_select_syntax_highlight();
 
-	FILE *fp = fopen(filename, "r");
+	int fd = open(filename, O_RDONLY);
+	struct stat st;
+
+	if (fd == -1 || fstat(fd, &st) == -1)
+		eru_error("[!] ERROR: eru: ");
+
+	size_t len = st.st_size, off = 0;
+	char *buf = (len > 0) ? mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+
+	if (buf != MAP_FAILED) {
+		piece_set_orig(&eru.pt, buf, len, 1);
+	} else {
+		if ((buf = malloc(len ? len : 1)) == NULL)
+			eru_error("[!] ERROR: eru: ");
+
+		while (off < len) {
+			ssize_t n = read(fd, buf + off, len - off);
+
+			if (n == -1 && errno == EINTR)
+				continue;
+
+			if (n <= 0)
+				eru_error("[!] ERROR: eru: ");
+
+			off += n;
+		}
+
+		piece_set_orig(&eru.pt, buf, len, 0);
+	}
+
+	close(fd);
+
+	struct LineIndex lines;
+	size_t i;
 
-	if (!fp)
+	if (scan_lines(buf, len, &lines) == -1)
 		eru_error("[!] ERROR: eru: ");
 
-	char *line = NULL;
-	size_t line_cap = 0;
-	ssize_t line_len;
+	for (i = 0; i < lines.count; i++) {
+		char *line = buf + lines.start[i];
+		size_t line_len = lines.start[i + 1] - 1 - lines.start[i];
 
-	while ((line_len = getline(&line, &line_cap, fp)) != -1) {
-		while (line_len > 0 && (line[line_len - 1] == '\n' || line[line_len - 1] == '\r'))
+		while (line_len > 0 && line[line_len - 1] == '\r')
 			line_len--;
-		
+
 		eru_insert_row(eru.num_rows, line, line_len);
 	}
 
-	free(line);
-	fclose(fp);
+	scan_free(&lines);
+	eru_select_syntax_highlight();
+	eru.dirty = 0;
+}
+
+/**
+ * Drop the document. Rows and all of their buffers go back with the arena
+ * in one pass instead of one free per line.
+**/
+void
+eru_close(void)
+{
+	piece_free(&eru.pt);
+	arena_release(&eru.arena);
+	history_free(&eru.history);
+
+	if (history_init(&eru.history, HISTORY_BUDGET) == -1)
+		eru_error("[!] ERROR: eru: ");
+
+	eru.num_rows = 0;
+	eru.hl_frontier = 0;
+	eru.match_len = 0;
+	eru.cur_x = 0;
+	eru.cur_y = 0;
+	eru.row_offset = 0;
+	eru.col_offset = 0;
 	eru.dirty = 0;
+	eru_damage_all();
 }
 
 void
@@ -132,28 +226,168 @@ eru_save(void)
 		eru_select_syntax_highlight();
 	}
 
-	int len;
-	char *buf = eru_rows_to_string(&len);
-	int fd = open(eru.filename, O_RDWR | O_CREAT, 0644);
+	struct timespec start, end;
+	size_t len, held;
 
-	if (fd != -1) {
-		if (ftruncate(fd, len) != -1) {
-			if (write(fd, buf, len) == len) {
-				close(fd);
-				free(buf);
+	clock_gettime(CLOCK_MONOTONIC, &start);
 
-				eru.dirty = 0;
-				eru_set_status_msg("[!] INFO: eru: %d bytes written to disk!", len);
+	if (eru_save_file(eru.filename, &len, &held) == -1) {
+		eru_set_status_msg("[!] ERROR: eru: Can't save, I/O error: %s", strerror(errno));
 
-				return;
-			}
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	eru.dirty = 0;
+	history_mark_saved(&eru.history);
+	eru_set_status_msg("[!] INFO: eru: %zu bytes written, %.1f MB/s, %zu bytes held",
+		len, secs > 0 ? len / secs / 1e6 : 0.0, held);
+}
+
+static int
+eru_writev_all(int fd, struct iovec *iov, int cnt)
+{
+	while (cnt > 0) {
+		ssize_t n = writev(fd, iov, cnt);
+
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+
+			return -1;
 		}
 
-		close(fd);
+		while (cnt > 0 && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			cnt--;
+		}
+
+		if (cnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Stream the rows straight out of the document into a temporary file next
+ * to the target, fsync it and rename it into place. A crash leaves either
+ * the old file or the new one, and the old inode stays valid under any
+ * mapping still viewing it. The temporary file takes the target's mode,
+ * and its owner and group where we are allowed to give them. *held is
+ * the most the save had to itself at once: the resolved path, the
+ * temporary name and the largest batch of iovecs.
+**/
+int
+eru_save_file(const char *filename, size_t *len, size_t *held)
+{
+	static char nl = '\n';
+	struct iovec iov[SAVE_IOV_MAX];
+	struct stat st;
+	char *path = realpath(filename, NULL);
+	const char *target = path ? path : filename;
+	size_t tmp_len = strlen(target) + sizeof(".eru-XXXXXX");
+	char *tmp = malloc(tmp_len);
+	int fd = -1, made = 0, cnt = 0, most = 0, err;
+	Row *row;
+
+	*len = 0;
+	*held = (path ? strlen(path) + 1 : 0) + tmp_len;
+
+	if (tmp == NULL)
+		goto fail;
+
+	snprintf(tmp, tmp_len, "%s.eru-XXXXXX", target);
+
+	if ((fd = mkstemp(tmp)) == -1)
+		goto fail;
+
+	made = 1;
+
+	if (stat(target, &st) == 0) {
+		if (fchown(fd, st.st_uid, st.st_gid) == -1 && errno != EPERM)
+			goto fail;
+
+		fchmod(fd, st.st_mode & 07777);
+	} else {
+		mode_t mask = umask(0);
+
+		umask(mask);
+		fchmod(fd, 0644 & ~mask);
+	}
+
+	for (row = eru_row(0); row; row = piece_row_next(row)) {
+		iov[cnt].iov_base = piece_row_chars(row);
+		iov[cnt].iov_len = row->size;
+		iov[cnt + 1].iov_base = &nl;
+		iov[cnt + 1].iov_len = 1;
+		cnt += 2;
+		*len += row->size + 1;
+
+		if (cnt == SAVE_IOV_MAX) {
+			most = cnt;
+
+			if (eru_writev_all(fd, iov, cnt) == -1)
+				goto fail;
+
+			cnt = 0;
+		}
+	}
+
+	if (cnt > most)
+		most = cnt;
+
+	*held += sizeof(struct iovec) * most;
+
+	if (eru_writev_all(fd, iov, cnt) == -1 || fsync(fd) == -1)
+		goto fail;
+
+	if (close(fd) == -1) {
+		fd = -1;
+		goto fail;
+	}
+
+	fd = -1;
+
+	if (rename(tmp, target) == -1)
+		goto fail;
+
+	char *slash = strrchr(tmp, '/');
+	int dir;
+
+	if (slash)
+		*slash = '\0';
+
+	if ((dir = open(slash ? tmp : ".", O_RDONLY)) != -1) {
+		fsync(dir);
+		close(dir);
 	}
 
-	free(buf);
-	eru_set_status_msg("[!] ERROR: eru: Can't save, I/O error: %s", strerror(errno));
+	free(tmp);
+	free(path);
+
+	return 0;
+
+fail:
+	err = errno;
+
+	if (fd != -1)
+		close(fd);
+
+	if (made)
+		unlink(tmp);
+
+	free(tmp);
+	free(path);
+	errno = err;
+
+	return -1;
 }
 
 void
@@ -162,7 +396,7 @@ eru_scroll(void)
 	eru.ren_x = 0;
 
 	if (eru.cur_y < eru.num_rows)
-		eru.ren_x = eru_row_curx_to_renx(&eru.row[eru.cur_y], eru.cur_x);
+		eru.ren_x = eru_row_curx_to_renx(eru_row(eru.cur_y), eru.cur_x);
 
 	if (eru.cur_y < eru.row_offset)
 		eru.row_offset = eru.cur_y;
@@ -177,14 +411,75 @@ eru_scroll(void)
 		eru.col_offset = eru.ren_x - eru.screen_cols + 1;
 }
 
+/**
+ * Screen lines are redrawn only when damaged. A changed row damages its
+ * own line, inserting or deleting one damages every line below it, and a
+ * scroll damages the whole screen.
+**/
+void
+eru_damage_row(int file_row)
+{
+	int i = file_row - eru.row_offset;
+
+	if (eru.damage && i >= 0 && i < eru.screen_rows)
+		eru.damage[i] = 1;
+}
+
+void
+eru_damage_from(int file_row)
+{
+	int i = file_row - eru.row_offset;
+
+	if (eru.damage && i < eru.screen_rows)
+		memset(&eru.damage[i < 0 ? 0 : i], 1, eru.screen_rows - (i < 0 ? 0 : i));
+}
+
 void
-eru_draw_rows(struct AppendBuffer *ab)
+eru_damage_all(void)
 {
+	if (eru.damage)
+		memset(eru.damage, 1, eru.screen_rows);
+}
+
+/**
+ * Follow the text after the terminal scrolled by n lines: pending damage
+ * moves with its rows and the lines scrolled in are damaged.
+**/
+void
+eru_damage_scroll(int n)
+{
+	int rows = eru.screen_rows;
+
+	if (n > 0) {
+		memmove(eru.damage, &eru.damage[n], rows - n);
+		memset(&eru.damage[rows - n], 1, n);
+	} else {
+		memmove(&eru.damage[-n], eru.damage, rows + n);
+		memset(eru.damage, 1, -n);
+	}
+}
+
+void
+eru_draw_rows(void)
+{
+	struct Screen *scr = &eru.screen;
 	int i;
 
+	if (eru.row_offset < eru.num_rows)
+		eru_row_ready(eru.row_offset + eru.screen_rows - 1 < eru.num_rows ?
+			eru.row_offset + eru.screen_rows - 1 : eru.num_rows - 1);
+
 	for (i = 0; i < eru.screen_rows; i++) {
 		int file_row = i + eru.row_offset;
+
+		if (!eru.damage[i])
+			continue;
+
+		eru.damage[i] = 0;
+
 		if (file_row >= eru.num_rows) {
+			screen_clear_row(scr, i, 0);
+
 			if (eru.num_rows == 0 && i == eru.screen_rows / 3) {
 				char info[80];
 				int info_len = snprintf(info, sizeof(info), "eru -- version %s", ERU_VERSION);
@@ -194,25 +489,16 @@ eru_draw_rows(struct AppendBuffer *ab)
 
 				int padding = (eru.screen_cols - info_len) / 2;
 
-				if (padding) {
-					abuf_append(ab, "~", 1);
-					padding--;
-				}
-
-				while (padding--)
-					abuf_append(ab, " ", 1);
+				if (padding)
+					screen_put(scr, i, 0, '~', 0, 0);
 
-				abuf_append(ab, info, info_len);
+				screen_puts(scr, i, padding, info, info_len, 0, 0);
 			} else {
-				abuf_append(ab, "~", 1);
+				screen_put(scr, i, 0, '~', 0, 0);
 			}
-
-			abuf_append(ab, "\x1b[K", 3);
-
-			if (i < eru.screen_rows - 1)
-				abuf_append(ab, "\r\n", 2);
 		} else {
-			int len = eru.row[file_row].rsize - eru.col_offset;
+			Row *row = eru_row_ready(file_row);
+			int len = row->rsize - eru.col_offset;
 
 			if (len < 0)
 				len = 0;
@@ -220,310 +506,486 @@ eru_draw_rows(struct AppendBuffer *ab)
 			if (len > eru.screen_cols)
 				len = eru.screen_cols;
 
-			char *c = &eru.row[file_row].render[eru.col_offset];
-			unsigned char *hl = &eru.row[file_row].highlight[eru.col_offset];
-			int curr_color = -1;
-			int j;
-
-			for (j = 0; j < len; j++) {
-				if (iscntrl(c[j])) {
-					char sym = (c[j] <= 26) ? '@' + c[j] : '?';
-					abuf_append(ab, "\x1b[7m", 4);
-					abuf_append(ab, &sym, 1);
-					abuf_append(ab, "\x1b[m", 3);
-
-					if (curr_color != -1) {
-						char buf[16];
-						int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", curr_color);
-						abuf_append(ab, buf, clen);
-					}
-				} else if (hl[j] == HIGHLIGHT_NORMAL) {
-					if (curr_color != -1) {
-						abuf_append(ab, "\x1b[39m", 5);
-						curr_color = -1;
-					}
+			char *c = &row->render[eru.col_offset];
+			const struct HlRun *run = &row->hl[eru_row_hl_at(row, eru.col_offset)];
+			int j = 0;
 
-					abuf_append(ab, &c[j], 1);
-				} else {
-					int color = eru_syntax_colored(hl[j]);
+			for (; j < len; run++) {
+				int last = (run == &row->hl[row->num_hl - 1]);
+				int end = last ? len : (int)run->end - eru.col_offset;
+				int fg = (run->hl == HIGHLIGHT_NORMAL) ? 0 : eru_syntax_colored(run->hl);
 
-					if (color != curr_color) {
-						char buf[16];
-						int c_len = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
-						abuf_append(ab, buf, c_len);
+				if (end > len)
+					end = len;
+
+				for (; j < end; j++) {
+					if (iscntrl(c[j])) {
+						char sym = (c[j] <= 26) ? '@' + c[j] : '?';
+
+						screen_put(scr, i, j, sym, 0, SCREEN_INVERSE);
+					} else {
+						screen_put(scr, i, j, c[j], fg, 0);
 					}
+				}
+			}
 
-					abuf_append(ab, &c[j], 1);
+			if (file_row == eru.match_row && eru.match_len > 0) {
+				int end = eru.match_col + eru.match_len - eru.col_offset;
+
+				if (end > len)
+					end = len;
+
+				for (j = eru.match_col - eru.col_offset; j < end; j++) {
+					if (j >= 0 && !iscntrl(c[j]))
+						screen_put(scr, i, j, c[j], eru_syntax_colored(HIGHLIGHT_MATCH), 0);
 				}
 			}
 
-			abuf_append(ab, "\x1b[K", 3);
+			screen_clear_row(scr, i, len);
 		}
-
-		abuf_append(ab, "\x1b[K", 3);
-		abuf_append(ab, "\r\n", 2);
 	}
 }
 
+/**
+ * Draw the frame into the back grid, then send only the cells that differ
+ * from what the terminal already shows. The search match's row is damaged
+ * once the scroll has settled, since a search jump only fixes row_offset
+ * here.
+**/
 void
 eru_clear_screen(void)
 {
-	struct AppendBuffer ab = ABUF_INIT;
+	struct AppendBuffer *ab = &eru.frame;
 
 	eru_scroll();
+	abuf_reset(ab);
+	abuf_append(ab, "\x1b[?25l", 6);
+
+	if (eru.col_offset != eru.frame_col_offset) {
+		eru_damage_all();
+	} else if (eru.row_offset != eru.frame_row_offset) {
+		int n = eru.row_offset - eru.frame_row_offset;
+
+		if (screen_scroll(&eru.screen, ab, 0, eru.screen_rows - 1, n) == 0)
+			eru_damage_scroll(n);
+		else
+			eru_damage_all();
+	}
 
-	abuf_append(&ab, "\x1b[?25l", 6);
-	abuf_append(&ab, "\x1b[H", 3);
+	eru.frame_row_offset = eru.row_offset;
+	eru.frame_col_offset = eru.col_offset;
 
-	eru_draw_rows(&ab);
-	eru_draw_status_bar(&ab);
-	eru_draw_msg_bar(&ab);
+	if (eru.match_len > 0)
+		eru_damage_row(eru.match_row);
+
+	eru_draw_rows();
+	eru_draw_status_bar();
+	eru_draw_msg_bar();
+	screen_flush(&eru.screen, ab);
 
 	char buf[32];
 	snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (eru.cur_y - eru.row_offset) + 1, 
 		(eru.ren_x - eru.col_offset) + 1);
 
-	abuf_append(&ab, buf, strlen(buf));
-	abuf_append(&ab, "\x1b[?25h", 6);
+	abuf_append(ab, buf, strlen(buf));
+	abuf_append(ab, "\x1b[?25h", 6);
+	eru.screen.cur_y = eru.cur_y - eru.row_offset;
+	eru.screen.cur_x = eru.ren_x - eru.col_offset;
 	
-	write(STDOUT_FILENO, ab.buf, ab.len);
-	abuf_free(&ab);
+	if (eru_write_all(ab->buf, ab->len) == -1)
+		eru_error("[!] ERROR: eru: ");
+
+	eru.frames++;
+	eru.frame_bytes = ab->len;
+	eru.total_bytes += ab->len;
 }
 
+/**
+ * Return the next key, reading more input only once the ring runs dry. A
+ * lone ESC is told apart from the start of a sequence by waiting
+ * INPUT_ESC_WAIT milliseconds for the rest of it.
+**/
 int
 eru_read_key(void)
 {
-	int nread;
-	char c;
-
-	while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
-		if (nread == -1 && errno != EAGAIN)
-			eru_error("[!] ERROR: eru: ");
-	}
-	
-	if (c == '\x1b') {
-		char seq[3];
-
-		if (read(STDIN_FILENO, &seq[0], 1) != 1)
-			return '\x1b';
+	int key;
 
-		if (read(STDIN_FILENO, &seq[1], 1) != 1)
-			return '\x1b';
+	while (!input_key(&eru.input, &key, 0)) {
+		int n = input_fill(&eru.input, input_pending(&eru.input) ? INPUT_ESC_WAIT : -1);
 
-		if (seq[0] == '[') {
-			if (seq[1] >= '0' && seq[1] <= '9') {
-				if (read(STDIN_FILENO, &seq[2], 1) != 1)
-					return '\x1b';
+		if (n == -1)
+			eru_error("[!] ERROR: eru: ");
 
-				if (seq[2] == '~') {
-					switch (seq[1]) {
-					case '1':
-						return HOME;
+		if (n == 0 && input_pending(&eru.input) && input_key(&eru.input, &key, 1))
+			break;
+	}
 
-					case '3':
-						return DELETE;
+	return key;
+}
 
-					case '4':
-						return END;
+/**
+ * Whether a key can be had without waiting. Pulls in anything else the
+ * terminal has already sent, so a burst is handled before the next redraw.
+**/
+int
+eru_key_ready(void)
+{
+	if (input_pending(&eru.input) == 0 && input_fill(&eru.input, 0) == -1)
+		eru_error("[!] ERROR: eru: ");
 
-					case '5':
-						return PAGE_UP;
+	return input_pending(&eru.input) > 0;
+}
 
-					case '6':
-						return PAGE_DOWN;
+/**
+ * Pick up the new window size after a SIGWINCH. The grids are rebuilt and
+ * the next flush repaints the whole screen.
+**/
+void
+eru_resize(void)
+{
+	int rows, cols, can_scroll = eru.screen.can_scroll;
 
-					case '7':
-						return HOME;
+	if (get_window_size(&rows, &cols) == -1)
+		return;
 
-					case '8':
-						return END;
-					}
-				}
-			} else {
-				switch (seq[1]) {
-				case 'A':
-					return UP;
+	if (rows < 3)
+		rows = 3;
 
-				case 'B':
-					return DOWN;
+	if (rows - 2 == eru.screen_rows && cols == eru.screen_cols)
+		return;
 
-				case 'C':
-					return RIGHT;
+	unsigned char *damage = realloc(eru.damage, rows - 2);
 
-				case 'D':
-					return LEFT;
+	if (damage == NULL)
+		eru_error("[!] ERROR: eru: ");
 
-				case 'H':
-					return HOME;
+	eru.damage = damage;
+	eru.screen_rows = rows - 2;
+	eru.screen_cols = cols;
+	screen_free(&eru.screen);
 
-				case 'F':
-					return END;
-				}
-			}
-		} else if (seq[0] == '0') {
-			switch (seq[1]) {
-			case 'H':
-				return HOME;
+	if (screen_init(&eru.screen, eru.screen_rows + 2, eru.screen_cols) == -1)
+		eru_error("[!] ERROR: eru: ");
 
-			case 'F':
-				return END;
-			}
-		}
+	eru.screen.can_scroll = can_scroll;
+	eru_damage_all();
+}
 
-		return '\x1b';
-	} else {
-		return c;
-	}
+Row *
+eru_row(int cur_pos)
+{
+	return piece_row(&eru.pt, cur_pos);
 }
 
+/**
+ * The new row views s directly, so s must point into the piece table.
+**/
 void
 eru_insert_row(int cur_pos, char *s, size_t len)
 {
 	if (cur_pos < 0 || cur_pos > eru.num_rows)
 		return;
-	
-	eru.row = realloc(eru.row, sizeof(Row) * (eru.num_rows + 1));
-	memmove(&eru.row[cur_pos + 1], &eru.row[cur_pos], sizeof(Row) * (eru.num_rows - cur_pos));
 
-	for (int j = cur_pos + 1; j <= eru.num_rows; j++)
-		eru.row[j].idx++;
-	
-	eru.row[cur_pos].idx = cur_pos;
-	eru.row[cur_pos].size = len;
-	eru.row[cur_pos].chars = malloc(len + 1);
-
-	memcpy(eru.row[cur_pos].chars, s, len);
-	eru.row[cur_pos].chars[len] = '\0';
-	eru.row[cur_pos].rsize = 0;
-	eru.row[cur_pos].render = NULL;
-	eru.row[cur_pos].highlight = NULL;
-	eru.row[cur_pos].hl_open_comment = 0;
-
-	eru_update_row(&eru.row[cur_pos]);
+	Row *row = piece_insert(&eru.pt, cur_pos, s, len);
+
+	if (row == NULL)
+		eru_error("[!] ERROR: eru: ");
+
+	if (cur_pos < eru.hl_frontier)
+		eru.hl_frontier = cur_pos;
+
+	eru_damage_from(cur_pos);
 	eru.num_rows++;
 	eru.dirty++;
 }
 
-void
-eru_update_row(Row *row)
+/**
+ * Render and highlight are built on demand, walking forward from
+ * hl_frontier; every row above it has its states right. A row is lexed
+ * again only if it changed or the state it starts in, the hl_out of the
+ * row above, is not the hl_in it was lexed with. Once a relexed row ends
+ * in the state it ended in before, the rows after it are left alone, so
+ * the rest of the walk is flag checks. Rows whose states came from
+ * eru_lex_all() get their highlight built when they are asked for. Only
+ * rows up to cur_pos are done here; the idle highlighter takes care of
+ * those further down.
+**/
+Row *
+eru_row_ready(int cur_pos)
 {
-	int i, idx = 0, tabs = 0;
-	
-	for (i = 0; i < row->size; i++) {
-		if (row->chars[i] == '\t')
-			tabs++;
-	}
+	Row *row = eru_row(cur_pos);
 
-	free(row->render);
-	row->render = malloc(row->size + tabs * (TAB_STOP - 1) + 1);
+	if (row == NULL)
+		return row;
 
-	for (i = 0; i < row->size; i++) {
-		if (row->chars[i] == '\t') {
-			row->render[idx++] = ' ';
+	if (cur_pos < eru.hl_frontier) {
+		if (!(row->flags & ROW_HL))
+			eru_update_syntax(row, row->hl_in);
 
-			while (idx % TAB_STOP != 0)
-				row->render[idx++] = ' ';
-		} else {
-			row->render[idx++] = row->chars[i];
-		}
+		return row;
 	}
 
-	row->render[idx] = '\0';
-	row->rsize = idx;
-	eru_update_syntax(row);
-}
+	Row *r = eru_row(eru.hl_frontier);
+	Row *prev = piece_row_prev(r);
+	int state = prev ? prev->hl_out : LEX_NORMAL;
+	int idx = eru.hl_frontier;
 
-int
-eru_row_curx_to_renx(Row *row, int cx)
-{
-	int rx = 0, i;
+	for (;;) {
+		if (!(r->flags & ROW_LEX) || r->hl_in != state || (r == row && !(r->flags & ROW_HL))) {
+			eru_update_syntax(r, state);
+			eru_damage_row(idx);
+		}
 
-	for (i = 0; i < cx; i++) {
-		if (row->chars[i] == '\t')
-			rx += (TAB_STOP - 1) - (rx % TAB_STOP);
+		state = r->hl_out;
 
-		rx++;
+		if (r == row)
+			break;
+
+		r = piece_row_next(r);
+		idx++;
 	}
 
-	return rx;
+	eru.hl_frontier = cur_pos + 1;
+
+	return row;
 }
 
+/**
+ * Idle task: highlight a slice of rows past the frontier, up to
+ * IDLE_HL_AHEAD rows below the screen, so scrolling finds them ready.
+**/
 int
-eru_row_renx_to_curx(Row *row, int rx)
+eru_idle_highlight(void *arg)
 {
-	int cur_rx = 0;
-	int cx;
+	int limit = eru.row_offset + eru.screen_rows + IDLE_HL_AHEAD;
+	int stop = eru.hl_frontier + IDLE_HL_ROWS;
 
-	for (cx = 0; cx < row->size; cx++) {
-		if (row->chars[cx] == '\t')
-			cur_rx += (TAB_STOP - 1) - (cur_rx % TAB_STOP);
+	(void)arg;
 
-		cur_rx++;
+	if (limit > eru.num_rows)
+		limit = eru.num_rows;
 
-		if (cur_rx > rx)
-			return cx;
-	}
+	if (stop > limit)
+		stop = limit;
 
-	return cx;
+	if (eru.hl_frontier >= stop)
+		return 0;
+
+	eru_row_ready(stop - 1);
+
+	return eru.hl_frontier < limit;
 }
 
-char *
-eru_rows_to_string(int *buf_len)
+/**
+ * Mark the row's render and highlight stale after its chars changed.
+**/
+void
+eru_update_row(Row *row)
 {
-	int total_len = 0;
-	int i;
+	int idx = piece_row_index(row);
 
-	for (i = 0; i < eru.num_rows; i++)
-		total_len += eru.row[i].size + 1;
+	row->flags &= ~(ROW_RENDER | ROW_HL | ROW_LEX);
+	eru_damage_row(idx);
 
-	*buf_len = total_len;
-	char *buf = malloc(total_len);
-	char *p = buf;
+	if (idx < eru.hl_frontier)
+		eru.hl_frontier = idx;
+}
 
-	for (i = 0; i < eru.num_rows; i++) {
-		memcpy(p, eru.row[i].chars, eru.row[i].size);
-		p += eru.row[i].size;
-		*p = '\n';
-		p++;
+/**
+ * Make room for a checkpoint per ROW_CKPT chars, or drop the index once
+ * the row is short enough to be rebuilt whole.
+**/
+static void
+eru_row_ckpt_reserve(Row *row)
+{
+	int want = row->size / ROW_CKPT + 1;
+
+	if (row->size < ROW_CKPT) {
+		arena_free(&eru.arena, row->ckpt);
+		row->ckpt = NULL;
+		row->num_ckpt = row->num_lex = row->ckpt_cap = 0;
+
+		return;
+	}
+
+	if (want > row->ckpt_cap) {
+		int cap = row->ckpt_cap ? row->ckpt_cap : 16;
+
+		while (cap < want)
+			cap *= 2;
+
+		struct RowCkpt *buf = arena_realloc(&eru.arena, row->ckpt, sizeof(struct RowCkpt) * cap);
+
+		if (buf == NULL)
+			eru_error("[!] ERROR: eru: ");
+
+		row->ckpt = buf;
+		row->ckpt_cap = cap;
+	}
+}
+
+/**
+ * Expand tabs from the last good checkpoint onward; the render before it
+ * is kept. A long row therefore costs only its tail after an edit, and
+ * the checkpoints are laid down as the chars go by.
+**/
+void
+eru_render_row(Row *row)
+{
+	int i, idx = 0, tabs = 0;
+	int from = 0;
+
+	if (row->flags & ROW_RENDER)
+		return;
+
+	eru_row_ckpt_reserve(row);
+
+	if (row->num_ckpt > 0 && row->render != NULL) {
+		from = (row->num_ckpt - 1) * ROW_CKPT;
+		idx = row->ckpt[row->num_ckpt - 1].rx;
+	} else {
+		row->num_lex = 0;
+	}
+
+	for (i = from; i < row->size; i++) {
+		if (ROW_CHAR(row, i) == '\t')
+			tabs++;
+	}
+
+	int len = idx + (row->size - from) + tabs * (TAB_STOP - 1) + 1;
+
+	if (from == 0) {
+		arena_free(&eru.arena, row->render);
+		row->render = arena_alloc(&eru.arena, len);
+	} else {
+		row->render = arena_realloc(&eru.arena, row->render, len);
+	}
+
+	if (row->render == NULL)
+		eru_error("[!] ERROR: eru: ");
+
+	for (i = from; i < row->size; i++) {
+		char c = ROW_CHAR(row, i);
+
+		if (row->ckpt && i % ROW_CKPT == 0)
+			row->ckpt[i / ROW_CKPT].rx = idx;
+
+		if (c == '\t') {
+			row->render[idx++] = ' ';
+
+			while (idx % TAB_STOP != 0)
+				row->render[idx++] = ' ';
+		} else {
+			row->render[idx++] = c;
+		}
+	}
+
+	if (row->ckpt) {
+		if (row->size % ROW_CKPT == 0)
+			row->ckpt[row->size / ROW_CKPT].rx = idx;
+
+		row->num_ckpt = row->size / ROW_CKPT + 1;
+	}
+
+	row->render[idx] = '\0';
+	row->rsize = idx;
+	row->flags |= ROW_RENDER;
+}
+
+/**
+ * Long rows start from the checkpoint at or before cx, so this walks at
+ * most ROW_CKPT chars.
+**/
+int
+eru_row_curx_to_renx(Row *row, int cx)
+{
+	int rx = 0, i = 0;
+
+	if (cx >= ROW_CKPT) {
+		eru_render_row(row);
+		i = cx / ROW_CKPT * ROW_CKPT;
+		rx = row->ckpt[cx / ROW_CKPT].rx;
+	}
+
+	for (; i < cx; i++) {
+		if (ROW_CHAR(row, i) == '\t')
+			rx += (TAB_STOP - 1) - (rx % TAB_STOP);
+
+		rx++;
+	}
+
+	return rx;
+}
+
+int
+eru_row_renx_to_curx(Row *row, int rx)
+{
+	int cur_rx = 0;
+	int cx = 0;
+
+	if (row->size >= ROW_CKPT) {
+		int lo = 0, hi;
+
+		eru_render_row(row);
+		hi = row->num_ckpt - 1;
+
+		while (lo < hi) {
+			int mid = (lo + hi + 1) / 2;
+
+			if (row->ckpt[mid].rx <= rx)
+				lo = mid;
+			else
+				hi = mid - 1;
+		}
+
+		cx = lo * ROW_CKPT;
+		cur_rx = row->ckpt[lo].rx;
+	}
+
+	for (; cx < row->size; cx++) {
+		if (ROW_CHAR(row, cx) == '\t')
+			cur_rx += (TAB_STOP - 1) - (cur_rx % TAB_STOP);
+
+		cur_rx++;
+
+		if (cur_rx > rx)
+			return cx;
 	}
 
-	return buf;
+	return cx;
 }
 
 void
 eru_row_append_string(Row *row, char *s, size_t len)
 {
-	row->chars = realloc(row->chars, row->size + len + 1);
-	memcpy(&row->chars[row->size], s, len);
-	row->size += len;
-	row->chars[row->size] = '\0';
+	if (piece_row_insert(&eru.pt, row, row->size, s, len) == -1)
+		eru_error("[!] ERROR: eru: ");
 
 	eru_update_row(row);
 	eru.dirty++;
 }
 
 void
-eru_draw_status_bar(struct AppendBuffer *ab)
+eru_draw_status_bar(void)
 {
-	abuf_append(ab, "\x1b[7m", 4);
+	int y = eru.screen_rows;
 	char status[80], rstatus[80];
 	int len = snprintf(status, sizeof(status), "%.20s -- %d lines %s",
 		eru.filename ? eru.filename : "[NO NAME]", eru.num_rows, eru.dirty ? "(modified)" : "");
 	int rlen = snprintf(rstatus, sizeof(rstatus), "%s | %d/%d", eru.syntax ? eru.syntax->filetype :
 			"No Filetype", eru.cur_y + 1, eru.num_rows);
 
+	len = screen_puts(&eru.screen, y, 0, status, len, 0, SCREEN_INVERSE);
+
 	while (len < eru.screen_cols) {
 		if (eru.screen_cols - len == rlen) {
-			abuf_append(ab, " ", 1);
+			screen_puts(&eru.screen, y, len, rstatus, rlen, 0, SCREEN_INVERSE);
 			break;
 		} else {
-			abuf_append(ab, " ", 1);
+			screen_put(&eru.screen, y, len, ' ', 0, SCREEN_INVERSE);
 			len++;
 		}
 	}
-
-	abuf_append(ab, "\x1b[m", 3);
-	abuf_append(ab, "\r\n", 2);
 }
 
 void
@@ -536,32 +998,37 @@ eru_set_status_msg(const char *fmt, ...)
 	va_end(ap);
 
 	eru.status_msg_time = time(NULL);
+
+	event_cancel(&eru.events, eru.msg_timer);
+	eru.msg_timer = event_timer(&eru.events, MSG_TIMEOUT, eru_msg_expire, NULL);
 }
 
+/**
+ * Timer callback: take the message down once it has been up for
+ * MSG_TIMEOUT, without waiting for a key to trigger the redraw.
+**/
 void
-eru_draw_msg_bar(struct AppendBuffer *ab)
+eru_msg_expire(void *arg)
 {
-	abuf_append(ab, "\x1b[K", 3);
-	int msg_len = strlen(eru.status_msg);
-
-	if (msg_len > eru.screen_cols)
-		msg_len = eru.screen_cols;
+	(void)arg;
 
-	if (msg_len && time(NULL) - eru.status_msg_time < 5)
-		abuf_append(ab, eru.status_msg, msg_len);
+	eru.status_msg[0] = '\0';
+	eru.msg_timer = -1;
 }
 
 void
-abuf_append(struct AppendBuffer *ab, const char *s, int len)
+eru_draw_msg_bar(void)
 {
-	char *new_buf = realloc(ab->buf, ab->len + len);
+	int y = eru.screen_rows + 1;
+	int msg_len = strlen(eru.status_msg);
 
-	if (new_buf == NULL)
-		return;
+	screen_clear_row(&eru.screen, y, 0);
+
+	if (msg_len > eru.screen_cols)
+		msg_len = eru.screen_cols;
 
-	memcpy(&new_buf[ab->len], s, len);
-	ab->buf = new_buf;
-	ab->len += len;
+	if (msg_len && time(NULL) - eru.status_msg_time < 5)
+		screen_puts(&eru.screen, y, 0, eru.status_msg, msg_len, 0, 0);
 }
 
 void
@@ -589,12 +1056,6 @@ buffer_insert(struct Buffer *buf, SDL_Keycode kc)
 }
 */
 
-void
-abuf_free(struct AppendBuffer *ab)
-{
-	free(ab->buf);
-}
-
 int
 get_window_size(int *rows, int *cols)
 {
@@ -690,150 +1151,358 @@ eru_select_syntax_highlight(void)
 			if ((is_ext && ext && !strcmp(ext, s->file_match[j]) ||
 				(!is_ext && strstr(eru.filename, s->file_match[j])))) {
 				
+				if (s->lex == NULL && (s->lex = lexer_compile(s->sline_comment_start,
+					s->mline_comment_start, s->mline_comment_end, s->keywords, s->flags)) == NULL)
+					eru_error("[!] ERROR: eru: ");
+
 				eru.syntax = s;
-				int file_row;
+				Row *row;
+
+				for (row = eru_row(0); row; row = piece_row_next(row)) {
+					row->flags &= ~(ROW_HL | ROW_LEX);
+					row->num_lex = 0;
+				}
 
-				for (file_row = 0; file_row < eru.num_rows; file_row++)
-					eru_update_syntax(&eru.row[file_row]);
+				eru.hl_frontier = 0;
+				eru_lex_all();
 
 				return;
 			}
 
-			i++;
+			j++;
 		}
 	}
 }
 
+/**
+ * Index of the run holding render column rx. Rows keep few runs unless
+ * they are long, so a binary search is plenty.
+**/
+int
+eru_row_hl_at(const Row *row, int rx)
+{
+	int lo = 0, hi = row->num_hl - 1;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if ((int)row->hl[mid].end <= rx)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/**
+ * Drop the highlight from render column at onward.
+**/
+static void
+eru_hl_cut(Row *row, int at)
+{
+	while (row->num_hl > 1 && (int)row->hl[row->num_hl - 2].end >= at)
+		row->num_hl--;
+
+	if (row->num_hl == 1 && at == 0)
+		row->num_hl = 0;
+
+	if (row->num_hl > 0 && (int)row->hl[row->num_hl - 1].end > at)
+		row->hl[row->num_hl - 1].end = at;
+}
+
+/**
+ * Give columns at to at + len class hl, dropping whatever was highlighted
+ * from at on; at must not be past the end of it. The lexer only writes at
+ * or just behind the end, so this is almost always growing the last run.
+ * Past HL_RUN_MAX the last run is left to cover the rest of the row.
+**/
+static void
+eru_hl_put(Row *row, int at, int len, int hl)
+{
+	struct HlRun *run;
+	int end = (len > HL_RUN_MAX - at) ? HL_RUN_MAX : at + len;
+
+	if (at >= HL_RUN_MAX && row->num_hl > 0)
+		return;
+
+	eru_hl_cut(row, at);
+
+	if (row->num_hl > 0 && (run = &row->hl[row->num_hl - 1])->hl == hl) {
+		run->end = end;
+		return;
+	}
+
+	if (row->num_hl == row->hl_cap) {
+		int cap = row->hl_cap ? row->hl_cap * 2 : 4;
+
+		run = arena_realloc(&eru.arena, row->hl, sizeof(struct HlRun) * cap);
+
+		if (run == NULL)
+			eru_error("[!] ERROR: eru: ");
+
+		row->hl = run;
+		row->hl_cap = cap;
+	}
+
+	run = &row->hl[row->num_hl++];
+	run->end = end;
+	run->hl = hl;
+}
+
+/**
+ * Lex the row starting in state, the hl_out of the row above, and leave
+ * the state it ends in in hl_out. Each byte is one lookup in the syntax's
+ * DFA; only a word starting after a separator costs a keyword probe.
+ * The highlight is kept as runs, so a line of one class is one run.
+**/
 void
-eru_update_syntax(Row *row)
+eru_update_syntax(Row *row, int state)
 {
-	row->highlight = realloc(row->highlight, row->rsize);
-	memset(row->highlight, HIGHLIGHT_NORMAL, row->rsize);
+	if (row->hl_in != state || eru.syntax == NULL)
+		row->num_lex = 0;
+
+	eru_render_row(row);
+	row->flags |= ROW_HL | ROW_LEX;
+	row->hl_in = state;
+
+	if (eru.syntax == NULL) {
+		row->num_hl = 0;
+
+		if (row->rsize > 0)
+			eru_hl_put(row, 0, row->rsize, HIGHLIGHT_NORMAL);
 
-	if (eru.syntax == NULL)
+		row->hl_out = LEX_NORMAL;
 		return;
-	
-	char **keywords = eru.syntax->keywords;
-	char *scs = eru.syntax->sline_comment_start;
-	char *mcs = eru.syntax->mline_comment_start;
-	char *mce = eru.syntax->mline_comment_end;
-	
-	int scs_len = scs ? strlen(scs) : 0;
-	int mcs_len = mcs ? strlen(mcs) : 0;
-	int mce_len = mce ? strlen(mce) : 0;
-	int prev_sep = 1;
-	int in_str = 0;
-	int in_cmt = (row->idx > 0 && eru.row[row->idx - 1].hl_open_comment);
+	}
+
+	const struct Lexer *lex = eru.syntax->lex;
+	int next = row->num_lex;
+	int at = lex->start[state];
 	int i = 0;
 
+	if (next > 0) {
+		i = row->ckpt[next - 1].pos;
+		at = row->ckpt[next - 1].state;
+	}
+
+	eru_hl_cut(row, i);
+
 	while (i < row->rsize) {
-		char c = row->render[i];
-		unsigned char prev_hl = (i > 0) ? row->highlight[i - 1] : HIGHLIGHT_NORMAL;
+		const struct LexTrans *t;
 
-		if (scs_len && !in_str && !in_cmt) {
-			if (!strncmp(&row->render[i], scs, scs_len)) {
-				memset(&row->highlight[i], HIGHLIGHT_COMMENT, row->rsize - i);
-				break;
-			}
+		while (next < row->num_ckpt && i >= row->ckpt[next].rx) {
+			row->ckpt[next].pos = i;
+			row->ckpt[next++].state = at;
 		}
 
-		if (mcs_len && mce_len && !in_str) {
-			if (in_cmt) {
-				row->highlight[i] = HIGHLIGHT_ML_COMMENT;
-
-				if (!strncmp(&row->render[i], mce, mce_len)) {
-					memset(&row->highlight[i], HIGHLIGHT_ML_COMMENT, mce_len);
-					i += mce_len;
-					in_cmt = 0;
-					prev_sep = 1;
-					continue;
-				} else {
-					i++;
-					continue;
-				}
-			} else if (!strncmp(&row->render[i], mcs, mcs_len)) {
-				memset(&row->highlight[i], HIGHLIGHT_ML_COMMENT, mcs_len);
-				i += mcs_len;
-				in_cmt = 1;
-				continue;
-			}
+		if (at == lex->line) {
+			eru_hl_put(row, i, row->rsize - i, HIGHLIGHT_COMMENT);
+			break;
 		}
 
-		if (eru.syntax->flags & HIGHLIGHT_STRINGS) {
-			if (in_str) {
-				row->highlight[i] = HIGHLIGHT_STRING;
+		t = &lex->trans[at * lex->num_cls + lex->cls[(unsigned char)row->render[i]]];
 
-				if (c == '\\' && i + 1 < row->rsize) {
-					row->highlight[i + 1] = HIGHLIGHT_STRING;
-					i += 2;
-					continue;
-				}
+		if (t->kw) {
+			int klen = 1, type;
 
-				if (c == in_str)
-					in_str = 0;
+			while (klen <= lex->kw.max_len && !lex->sep[(unsigned char)row->render[i + klen]])
+				klen++;
 
-				i++;
-				prev_sep = 1;
+			if ((type = keyword_find(&lex->kw, &row->render[i], klen)) != KEYWORD_NONE) {
+				eru_hl_put(row, i, klen, (type == KEYWORD_2) ? HIGHLIGHT_KEYW2 : HIGHLIGHT_KEYW1);
+				i += klen;
+				at = lex->word;
 				continue;
-			} else {
-				if (c == '"' || c == '\'') {
-					in_str = c;
-					row->highlight[i] = HIGHLIGHT_STRING;
-					i++;
-					continue;
-				}
 			}
 		}
-		
-		if (eru.syntax->flags & HIGHLIGHT_NUMBERS) {
-			if (isdigit(c) && (prev_sep || prev_hl == HIGHLIGHT_NUMBER) ||
-				(c == '.' && prev_hl == HIGHLIGHT_NUMBER)) {
-			
-				row->highlight[i] = HIGHLIGHT_NUMBER;
-				i++;
-				prev_sep = 0;
-				continue;
-			}
+
+		if (t->back > 1)
+			eru_hl_put(row, i + 1 - t->back, t->back, t->hl);
+		else
+			eru_hl_put(row, i, 1, t->hl);
+
+		at = t->next;
+		i++;
+	}
+
+	row->num_lex = next;
+	row->hl_out = lex->out[at];
+}
+
+/**
+ * Run a row through the DFA the way eru_update_syntax() does, tabs
+ * expanded on the fly, but keep only the states. Nothing is allocated and
+ * only this row is written, so rows can be done on several threads at
+ * once. word has room for kw.max_len + 1 bytes.
+**/
+static void
+eru_lex_row_state(const struct Lexer *lex, Row *row, int state, char *word)
+{
+	int at = lex->start[state];
+	int i, rx = 0;
+
+	for (i = 0; i < row->size && at != lex->line; i++) {
+		unsigned char c = ROW_CHAR(row, i);
+		const struct LexTrans *t;
+
+		if (c == '\t') {
+			int n = TAB_STOP - rx % TAB_STOP;
+
+			rx += n;
+
+			while (n--)
+				at = lex->trans[at * lex->num_cls + lex->cls[' ']].next;
+
+			continue;
 		}
 
-		if (prev_sep) {
-			int j;
+		t = &lex->trans[at * lex->num_cls + lex->cls[c]];
 
-			for (j = 0; keywords[j]; j++) {
-				int klen = strlen(keywords[j]);
-				int kw2 = keywords[j][klen - 1] == "_";
+		if (t->kw) {
+			int klen = 1;
 
-				if (kw2)
-					klen--;
+			word[0] = c;
 
-				if (!strncmp(&row->render[i], keywords[j], klen) && is_separator(row->render[i + klen])) {
-					memset(&row->highlight[i], kw2 ? HIGHLIGHT_KEYW2 : HIGHLIGHT_KEYW1, klen);
-					i += klen;
-					break;
-				}
+			while (klen <= lex->kw.max_len && i + klen < row->size &&
+				!lex->sep[(unsigned char)ROW_CHAR(row, i + klen)]) {
+
+				word[klen] = ROW_CHAR(row, i + klen);
+				klen++;
 			}
 
-			if (keywords[j] != NULL) {
-				prev_sep = 0;
+			if (keyword_find(&lex->kw, word, klen) != KEYWORD_NONE) {
+				i += klen - 1;
+				rx += klen;
+				at = lex->word;
 				continue;
 			}
 		}
-		
-		prev_sep = is_separator(c);
-		i++;
+
+		at = t->next;
+		rx++;
+	}
+
+	row->hl_in = state;
+	row->hl_out = lex->out[at];
+	row->flags |= ROW_LEX;
+}
+
+struct LexJob {
+	const struct Lexer *lex;
+	int from, to;
+	Row *first, *last;
+};
+
+static void *
+eru_lex_worker(void *arg)
+{
+	struct LexJob *job = arg;
+	char *word = malloc(job->lex->kw.max_len + 1);
+	Row *row = job->first;
+	int i, state = LEX_NORMAL;
+
+	if (word == NULL)
+		return NULL;
+
+	for (i = job->from; i < job->to; i++) {
+		eru_lex_row_state(job->lex, row, state, word);
+		state = row->hl_out;
+		row = piece_row_next(row);
 	}
 
-	int changed = (row->hl_open_comment != in_cmt);
-	row->hl_open_comment = in_cmt;
+	free(word);
 
-	if (changed && row->idx + 1 < eru.num_rows)
-		eru_update_syntax(&eru.row[row->idx + 1]);
+	return NULL;
 }
 
-int
-is_separator(int c)
+/**
+ * Work out the state every row starts in for a freshly selected syntax.
+ * Files of HL_PARALLEL_MIN rows or more are cut into one chunk per CPU
+ * and each chunk is lexed on its own thread as if it began outside a
+ * comment. A pass down the chunk seams then relexes rows whose guess was
+ * wrong, stopping in each chunk as soon as a row's hl_in matches the
+ * state handed down to it. Highlights are still built only for rows that
+ * are drawn.
+**/
+void
+eru_lex_all(void)
+{
+	struct LexJob jobs[HL_MAX_THREADS];
+	pthread_t tids[HL_MAX_THREADS];
+	int started[HL_MAX_THREADS];
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	int n, i, state = LEX_NORMAL;
+
+	if (eru.syntax == NULL || eru.num_rows < HL_PARALLEL_MIN || ncpu < 2)
+		return;
+
+	const struct Lexer *lex = eru.syntax->lex;
+	char *word = malloc(lex->kw.max_len + 1);
+
+	if (word == NULL)
+		eru_error("[!] ERROR: eru: ");
+
+	n = (ncpu > HL_MAX_THREADS) ? HL_MAX_THREADS : ncpu;
+
+	for (i = 0; i < n; i++) {
+		jobs[i].lex = lex;
+		jobs[i].from = (long long)eru.num_rows * i / n;
+		jobs[i].to = (long long)eru.num_rows * (i + 1) / n;
+		jobs[i].first = eru_row(jobs[i].from);
+		jobs[i].last = eru_row(jobs[i].to - 1);
+		started[i] = 0;
+	}
+
+	for (i = 1; i < n; i++) {
+		if (pthread_create(&tids[i], NULL, eru_lex_worker, &jobs[i]) == 0)
+			started[i] = 1;
+		else
+			eru_lex_worker(&jobs[i]);
+	}
+
+	eru_lex_worker(&jobs[0]);
+
+	for (i = 1; i < n; i++) {
+		if (started[i])
+			pthread_join(tids[i], NULL);
+	}
+
+	for (i = 0; i < n; i++) {
+		Row *row = jobs[i].first;
+		int j;
+
+		for (j = jobs[i].from; j < jobs[i].to; j++) {
+			if ((row->flags & ROW_LEX) && row->hl_in == state)
+				break;
+
+			eru_lex_row_state(lex, row, state, word);
+			state = row->hl_out;
+			row = piece_row_next(row);
+		}
+
+		state = jobs[i].last->hl_out;
+	}
+
+	free(word);
+	eru.hl_frontier = eru.num_rows;
+}
+
+/**
+ * With ERU_STATS set in the environment, quitting clears the screen and
+ * leaves the arena and screen counters on stderr.
+**/
+static void
+eru_report_stats(void)
 {
-	return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
+	if (eru_write_all("\x1b[2J\x1b[H", 7) == -1)
+		return;
+
+	disable_raw_mode();
+	arena_report(&eru.arena, stderr);
+	fprintf(stderr, "eru: screen: %lu frames, %lu bytes written, %lu bytes last frame\n",
+		eru.frames, eru.total_bytes, eru.frame_bytes);
+	fprintf(stderr, "eru: screen: frame buffer holds %d KB\n", eru.frame.cap / 1024);
 }
 
 void
@@ -856,6 +1525,10 @@ eru_process_keypress(void)
 		}
 
 		eru_clear_screen();
+
+		if (getenv("ERU_STATS"))
+			eru_report_stats();
+
 		exit(0);
 		break;
 
@@ -863,12 +1536,15 @@ eru_process_keypress(void)
 	case DOWN:
 	case LEFT:
 	case RIGHT:
+		history_seal(&eru.history);
 		eru_move_cursor(c);
 		break;
 
 	case PAGE_UP:
 	case PAGE_DOWN:
 		{
+			history_seal(&eru.history);
+
 			if (c == PAGE_UP)
 				eru.cur_y = eru.row_offset;
 			else if (c == PAGE_DOWN)
@@ -886,12 +1562,15 @@ eru_process_keypress(void)
 		}
 
 	case HOME:
+		history_seal(&eru.history);
 		eru.cur_x = 0;
 		break;
 
 	case END:
+		history_seal(&eru.history);
+
 		if (eru.cur_y < eru.num_rows)
-			eru.cur_x = eru.row[eru.cur_y].size;
+			eru.cur_x = eru_row(eru.cur_y)->size;
 		break;
 
 	case BACKSPACE:
@@ -912,9 +1591,29 @@ eru_process_keypress(void)
 		break;
 
 	case CTRL_KEY('f'):
+		history_seal(&eru.history);
 		eru_search();
 		break;
 
+	case CTRL_KEY('z'):
+		eru_undo();
+		break;
+
+	case CTRL_KEY('y'):
+		eru_redo();
+		break;
+
+	case CTRL_KEY('b'):
+		eru_redo_branch();
+		break;
+
+	case PASTE_START:
+		eru_paste();
+		break;
+
+	case PASTE_END:
+		break;
+
 	default:
 		eru_insert_char(c);
 		break;
@@ -926,14 +1625,14 @@ eru_process_keypress(void)
 void
 eru_move_cursor(int key)
 {
-	Row *row = (eru.cur_y >= eru.num_rows) ? NULL : &eru.row[eru.cur_y];
+	Row *row = eru_row(eru.cur_y);
 	switch (key) {
 	case LEFT:
 		if (eru.cur_x != 0) {
 			eru.cur_x--;
 		} else if (eru.cur_y > 0) {
 			eru.cur_y--;
-			eru.cur_x = eru.row[eru.cur_y].size;
+			eru.cur_x = eru_row(eru.cur_y)->size;
 		}
 		
 		break;
@@ -961,7 +1660,7 @@ eru_move_cursor(int key)
 		break;
 	}
 
-	row = (eru.cur_y >= eru.num_rows) ? NULL : &eru.row[eru.cur_y];
+	row = eru_row(eru.cur_y);
 	int row_len = row ? row->size : 0;
 
 	if (eru.cur_x > row_len)
@@ -974,10 +1673,10 @@ eru_row_insert_char(Row *row, int cur_pos, int c)
 	if (cur_pos < 0 || cur_pos > row->size)
 		cur_pos = row->size;
 
-	row->chars = realloc(row->chars, row->size + 2);
-	memmove(&row->chars[cur_pos + 1], &row->chars[cur_pos], row->size - cur_pos + 1);
-	row->size++;
-	row->chars[cur_pos] = c;
+	char ch = c;
+
+	if (piece_row_insert(&eru.pt, row, cur_pos, &ch, 1) == -1)
+		eru_error("[!] ERROR: eru: ");
 
 	eru_update_row(row);
 	eru.dirty++;
@@ -989,8 +1688,8 @@ eru_row_del_char(Row *row, int cur_pos)
 	if (cur_pos < 0 || cur_pos >= row->size)
 		return;
 
-	memmove(&row->chars[cur_pos], &row->chars[cur_pos + 1], row->size - cur_pos);
-	row->size--;
+	if (piece_row_delete(&eru.pt, row, cur_pos, 1) == -1)
+		eru_error("[!] ERROR: eru: ");
 
 	eru_update_row(row);
 	eru.dirty++;
@@ -1004,35 +1703,97 @@ void eru_del_char(void)
 	if (eru.cur_x == 0 && eru.cur_y == 0)
 		return;
 
-	Row *row = &eru.row[eru.cur_y];
+	Row *row = eru_row(eru.cur_y);
+	Point before = { eru.cur_y, eru.cur_x };
 
 	if (eru.cur_x > 0) {
+		char c = ROW_CHAR(row, eru.cur_x - 1);
+
 		eru_row_del_char(row, eru.cur_x - 1);
 		eru.cur_x--;
+		eru_record(HISTORY_DELETE, (Point){ eru.cur_y, eru.cur_x }, &c, 1, before);
 	} else {
-		eru.cur_x = eru.row[eru.cur_y - 1].size;
-		eru_row_append_string(&eru.row[eru.cur_y - 1], row->chars, row->size);
+		Row *prev = eru_row(eru.cur_y - 1);
+
+		eru.cur_x = prev->size;
+		eru_row_append_string(prev, piece_row_chars(row), row->size);
 		eru_del_row(eru.cur_y);
 		eru.cur_y--;
+		eru_record(HISTORY_DELETE, (Point){ eru.cur_y, eru.cur_x }, "\n", 1, before);
 	}
 }
 
-void
-eru_insert_char(int c)
+/**
+ * Give the cursor a row to edit when it sits on the line past the end.
+**/
+static void
+eru_open_cursor_row(void)
 {
-	if (eru.cur_y == eru.num_rows)
+	Point before = { eru.cur_y, eru.cur_x };
+
+	if (eru.cur_y == eru.num_rows) {
+		Row *last = eru_row(eru.num_rows - 1);
+
 		eru_insert_row(eru.num_rows, "", 0);
 
-	eru_row_insert_char(&eru.row[eru.cur_y], eru.cur_x, c);
+		if (last)
+			eru_record(HISTORY_INSERT, (Point){ eru.cur_y - 1, last->size }, "\n", 1, before);
+		else
+			eru_record(HISTORY_INSERT, (Point){ 0, 0 }, "\n", 1, before);
+	}
+}
+
+void
+eru_insert_char(int c)
+{
+	Point before = { eru.cur_y, eru.cur_x };
+	char ch = c;
+
+	eru_open_cursor_row();
+	eru_row_insert_char(eru_row(eru.cur_y), eru.cur_x, c);
 	eru.cur_x++;
+	eru_record(HISTORY_INSERT, before, &ch, 1, before);
+}
+
+/**
+ * Insert a bracketed paste as a single edit. eru_insert_text() splices all
+ * of its lines in at once and each touched row is rendered and
+ * highlighted once, when it is next drawn.
+**/
+void
+eru_paste(void)
+{
+	Point before = { eru.cur_y, eru.cur_x };
+	char *text, *nl;
+	size_t len;
+
+	if (input_paste(&eru.input, &text, &len) == -1)
+		eru_error("[!] ERROR: eru: ");
+
+	if (len > 0) {
+		eru_open_cursor_row();
+		eru_insert_text(before, text, len);
+
+		for (nl = text; (nl = memchr(nl, '\n', len - (nl - text))) != NULL; nl++) {
+			eru.cur_y++;
+			eru.cur_x = len - (nl - text) - 1;
+		}
+
+		if (eru.cur_y == before.y)
+			eru.cur_x += len;
+
+		eru_record(HISTORY_INSERT, before, text, len, before);
+	}
+
+	free(text);
 }
 
 void
 eru_free_row(Row *row)
 {
-	free(row->render);
-	free(row->chars);
-	free(row->highlight);
+	arena_free(&eru.arena, row->render);
+	arena_free(&eru.arena, row->hl);
+	arena_free(&eru.arena, row->ckpt);
 }
 
 void
@@ -1041,12 +1802,13 @@ eru_del_row(int cur_pos)
 	if (cur_pos < 0 || cur_pos >= eru.num_rows)
 		return;
 
-	eru_free_row(&eru.row[cur_pos]);
-	memmove(&eru.row[cur_pos], &eru.row[cur_pos + 1], sizeof(Row) * (eru.num_rows - cur_pos - 1));
+	eru_free_row(eru_row(cur_pos));
+	piece_delete(&eru.pt, cur_pos);
 
-	for (int i = cur_pos; i < eru.num_rows - 1; i++)
-		eru.row[i].idx--;
+	if (cur_pos < eru.hl_frontier)
+		eru.hl_frontier = cur_pos;
 
+	eru_damage_from(cur_pos);
 	eru.num_rows--;
 	eru.dirty++;
 }
@@ -1054,12 +1816,17 @@ eru_del_row(int cur_pos)
 void
 eru_insert_newline(void)
 {
-	int file_row = eru.row_offset + eru.cur_y;
-	int file_col = eru.col_offset + eru.cur_x;
-	Row *row = (file_row >= eru.num_rows) ? NULL : &eru.row[file_row];
+	int file_row = eru.cur_y;
+	int file_col = eru.cur_x;
+	Row *row = eru_row(file_row);
+	Point before = { eru.cur_y, eru.cur_x };
+	Point at = { file_row, file_col };
 
 	if (!row) {
 		if (file_row == eru.num_rows) {
+			Row *last = eru_row(file_row - 1);
+
+			at = last ? (Point){ file_row - 1, last->size } : (Point){ 0, 0 };
 			eru_insert_row(file_row, "", 0);
 			goto fix_cursor;
 		}
@@ -1068,27 +1835,231 @@ eru_insert_newline(void)
 	}
 
 	if (file_col >= row->size)
-		file_col = row->size;
+		at.x = file_col = row->size;
 
 	if (file_col == 0) {
 		eru_insert_row(file_row, "", 0);
 	} else {
-		eru_insert_row(file_row + 1, row->chars + file_col, row->size - file_col);
-		row = &eru.row[file_row];
+		int len = row->size - file_col;
+		char *tail = &piece_row_chars(row)[file_col];
 
-		row->chars[file_col] = '\0';
-		row->size = file_col;
+		if (row->cap == 0) {
+			eru_insert_row(file_row + 1, tail, len);
+		} else {
+			eru_insert_row(file_row + 1, "", 0);
+
+			if (piece_row_insert(&eru.pt, eru_row(file_row + 1), 0, tail, len) == -1)
+				eru_error("[!] ERROR: eru: ");
+		}
+
+		piece_row_delete(&eru.pt, row, file_col, len);
 		eru_update_row(row);
 	}
 	
 fix_cursor:
-	if (eru.cur_y == eru.screen_rows - 1)
-		eru.row_offset++;
-	else
-		eru.cur_y++;
-
+	eru.cur_y++;
 	eru.cur_x = 0;
 	eru.col_offset = 0;
+
+	eru_record(HISTORY_INSERT, at, "\n", 1, before);
+}
+
+/**
+ * Insert len bytes of s at a point, splitting rows at each '\n'. Everything
+ * after the first line break, plus the tail of the row it lands in, is
+ * copied into the add buffer once and the new rows view it in place. In
+ * an empty document the first row is made first, and a final '\n' is the
+ * one that ends it.
+**/
+void
+eru_insert_text(Point at, const char *s, size_t len)
+{
+	if (eru.num_rows == 0 && len > 0) {
+		eru_insert_row(0, "", 0);
+		at = (Point){ 0, 0 };
+
+		if (s[len - 1] == '\n')
+			len--;
+	}
+
+	Row *row = eru_row(at.y);
+	const char *nl = memchr(s, '\n', len);
+
+	if (row == NULL || len == 0)
+		return;
+
+	if (at.x > row->size)
+		at.x = row->size;
+
+	if (nl == NULL) {
+		if (piece_row_insert(&eru.pt, row, at.x, s, len) == -1)
+			eru_error("[!] ERROR: eru: ");
+
+		eru_update_row(row);
+		eru.dirty++;
+
+		return;
+	}
+
+	size_t head = nl - s;
+	size_t rest = len - head - 1;
+	int tail = row->size - at.x;
+	char *buf = piece_reserve(&eru.pt, rest + tail);
+
+	if (buf == NULL)
+		eru_error("[!] ERROR: eru: ");
+
+	memcpy(buf, nl + 1, rest);
+	memcpy(buf + rest, &piece_row_chars(row)[at.x], tail);
+
+	if (piece_row_delete(&eru.pt, row, at.x, tail) == -1 ||
+		piece_row_insert(&eru.pt, row, at.x, s, head) == -1)
+		eru_error("[!] ERROR: eru: ");
+
+	eru_update_row(row);
+
+	char *p = buf, *end = buf + rest + tail;
+	int y = at.y + 1;
+
+	for (;;) {
+		char *eol = memchr(p, '\n', (buf + rest) - p);
+
+		if (eol == NULL) {
+			eru_insert_row(y, p, end - p);
+			break;
+		}
+
+		eru_insert_row(y++, p, eol - p);
+		p = eol + 1;
+	}
+}
+
+/**
+ * Delete len bytes starting at a point, counting each line break as one.
+ * The rows in between are dropped whole and the last one's remainder is
+ * joined onto the first. Deleting all of a lone row, its line break
+ * included, leaves the document empty.
+**/
+void
+eru_delete_text(Point at, size_t len)
+{
+	Row *row = eru_row(at.y);
+	Row *last;
+	Point end = at;
+
+	if (row == NULL || len == 0)
+		return;
+
+	if (eru.num_rows == 1 && at.x == 0 && len > (size_t)row->size) {
+		eru_del_row(0);
+		return;
+	}
+
+	for (last = row; last; last = piece_row_next(last)) {
+		size_t avail = last->size - end.x;
+
+		if (len <= avail) {
+			end.x += len;
+			break;
+		}
+
+		if (piece_row_next(last) == NULL) {
+			end.x = last->size;
+			break;
+		}
+
+		len -= avail + 1;
+		end.y++;
+		end.x = 0;
+	}
+
+	if (end.y == at.y) {
+		if (piece_row_delete(&eru.pt, row, at.x, end.x - at.x) == -1)
+			eru_error("[!] ERROR: eru: ");
+	} else {
+		if (piece_row_delete(&eru.pt, row, at.x, row->size - at.x) == -1 ||
+			piece_row_insert(&eru.pt, row, at.x, &piece_row_chars(last)[end.x], last->size - end.x) == -1)
+			eru_error("[!] ERROR: eru: ");
+
+		while (end.y-- > at.y)
+			eru_del_row(at.y + 1);
+	}
+
+	eru_update_row(row);
+	eru.dirty++;
+}
+
+/**
+ * Log an edit that was just applied, with the cursor as it stands now.
+**/
+void
+eru_record(int type, Point at, const char *text, size_t len, Point before)
+{
+	Point after = { eru.cur_y, eru.cur_x };
+
+	if (history_record(&eru.history, type, at, text, len, before, after) == -1)
+		eru_error("[!] ERROR: eru: ");
+}
+
+static void
+eru_history_cursor(Point pt)
+{
+	Row *row;
+
+	eru.cur_y = (pt.y > eru.num_rows) ? eru.num_rows : pt.y;
+	row = eru_row(eru.cur_y);
+	eru.cur_x = row ? (pt.x > row->size ? row->size : pt.x) : 0;
+
+	if (history_is_saved(&eru.history))
+		eru.dirty = 0;
+}
+
+void
+eru_undo(void)
+{
+	const struct HistoryNode *node = history_undo(&eru.history);
+
+	if (node == NULL) {
+		eru_set_status_msg("[!] INFO: eru: Already at oldest change");
+		return;
+	}
+
+	if (node->type == HISTORY_INSERT)
+		eru_delete_text(node->at, node->len);
+	else
+		eru_insert_text(node->at, node->text, node->len);
+
+	eru_history_cursor(node->before);
+}
+
+void
+eru_redo(void)
+{
+	const struct HistoryNode *node = history_redo(&eru.history);
+
+	if (node == NULL) {
+		eru_set_status_msg("[!] INFO: eru: Already at newest change");
+		return;
+	}
+
+	if (node->type == HISTORY_INSERT)
+		eru_insert_text(node->at, node->text, node->len);
+	else
+		eru_delete_text(node->at, node->len);
+
+	eru_history_cursor(node->after);
+}
+
+void
+eru_redo_branch(void)
+{
+	int count;
+	int pos = history_branch(&eru.history, &count);
+
+	if (pos == 0)
+		eru_set_status_msg("[!] INFO: eru: Nothing to redo");
+	else
+		eru_set_status_msg("[!] INFO: eru: Redo follows branch %d of %d", pos, count);
 }
 
 char *
@@ -1099,9 +2070,9 @@ eru_prompt(char *prompt, void (*func)(char *, int))
 	size_t buf_len = 0;
 	
 	buf[0] = '\0';
+	eru_set_status_msg(prompt, buf);
 
 	for (;;) {
-		eru_set_status_msg(prompt, buf);
 		eru_clear_screen();
 		int c = eru_read_key();
 
@@ -1136,6 +2107,8 @@ eru_prompt(char *prompt, void (*func)(char *, int))
 			buf[buf_len] = '\0';
 		}
 
+		eru_set_status_msg(prompt, buf);
+
 		if (func)
 			func(buf, c);
 	}
@@ -1148,7 +2121,7 @@ eru_search(void)
 	int saved_cur_y = eru.cur_y;
 	int saved_col_offset = eru.col_offset;
 	int saved_row_offset = eru.row_offset;
-	char *query = eru_prompt("[!] SEARCH: %s (Use Arrows/Enter, ESC to quit)", eru_search_cb);
+	char *query = eru_prompt("[!] SEARCH: %s " SEARCH_HELP, eru_search_cb);
 	
 	if (query) {
 		free(query);
@@ -1160,21 +2133,313 @@ eru_search(void)
 	}
 }
 
+/**
+ * Whether row can join a stretch of the original file ending at end:
+ * its chars view the file and only a line break lies between. Queries
+ * never hold a line break, so no match can span the join.
+**/
+static int
+eru_row_follows(const char *end, const Row *row)
+{
+	const char *p;
+
+	if (row->cap || row->chars <= end || row->chars + row->size > eru.pt.orig + eru.pt.orig_len)
+		return 0;
+
+	for (p = end; p < row->chars; p++) {
+		if (*p != '\n' && *p != '\r')
+			return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * The row of the stretch from row first to row last that holds match.
+ * Rows of a stretch view the file in order, so their chars pointers are
+ * sorted and a binary search finds it.
+**/
+static int
+eru_find_row(int first, int last, const char *match, int *cx)
+{
+	while (first < last) {
+		int mid = first + (last - first + 1) / 2;
+
+		if (eru_row(mid)->chars <= match)
+			first = mid;
+		else
+			last = mid - 1;
+	}
+
+	*cx = match - eru_row(first)->chars;
+
+	return first;
+}
+
+struct RowCursor {
+	void *const *rows;
+	int first, n;
+};
+
+/**
+ * Row idx, looked up a leaf at a time: rows asked for in order mostly
+ * come straight out of the leaf found last.
+**/
+static Row *
+eru_row_cursor(struct RowCursor *rc, int idx)
+{
+	if (idx < rc->first || idx >= rc->first + rc->n) {
+		rc->rows = piece_rows(&eru.pt, idx, &rc->n);
+		rc->first = idx;
+	}
+
+	return rc->rows[idx - rc->first];
+}
+
+/**
+ * Add the matches in the stretch from base to end, which holds rows first
+ * to last, to c->base until there are max of them. The first is placed
+ * by binary search, the rest by walking on from it. Returns 1 if it
+ * stopped at max with more left to find.
+**/
+static int
+eru_find_span(const struct Search *s, struct SearchCache *c, int max, int first, int last,
+	const char *base, const char *end)
+{
+	struct RowCursor rc = { NULL, 0, 0 };
+	const char *p = base, *match;
+	int idx = -1, cx;
+	Row *row = NULL;
+
+	while ((match = search_find(s, p, end - p)) != NULL) {
+		if (c->num_base == max)
+			return 1;
+
+		if (idx == -1) {
+			idx = eru_find_row(first, last, match, &cx);
+			row = eru_row_cursor(&rc, idx);
+		}
+
+		while (match >= row->chars + row->size)
+			row = eru_row_cursor(&rc, ++idx);
+
+		if (c->num_base == c->cap) {
+			int cap = c->cap ? c->cap * 2 : 64;
+			struct SearchHit *hit = realloc(c->base, sizeof(struct SearchHit) * cap);
+
+			if (hit == NULL)
+				eru_error("[!] ERROR: eru: ");
+
+			c->base = hit;
+			c->cap = cap;
+		}
+
+		c->base[c->num_base].row = idx;
+		c->base[c->num_base].cx = match - row->chars;
+		c->num_base++;
+		p = match + 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Put the matches in rows [lo, hi) into c->base, in order, stopping at
+ * max. Rows are walked a leaf at a time, and runs of rows still viewing
+ * the original file back to back go to search_find() as one stretch, so
+ * an untouched file is searched in a single pass. Having max hits is
+ * not enough to stop: the walk goes on until it sees one more, and only
+ * a walk that reaches hi without one has found them all. Returns 1 if
+ * there were more than max.
+**/
+static int
+eru_find_hits(const struct Search *s, struct SearchCache *c, int max, int lo, int hi)
+{
+	const char *base = NULL, *end = NULL;
+	int first = lo, joinable = 0, idx = lo;
+
+	c->num_base = 0;
+
+	while (idx < hi) {
+		int n, i;
+		void *const *rows = piece_rows(&eru.pt, idx, &n);
+
+		for (i = 0; i < n && idx < hi; i++, idx++) {
+			Row *row = rows[i];
+
+			if (joinable && eru_row_follows(end, row)) {
+				end = row->chars + row->size;
+				continue;
+			}
+
+			if (base && eru_find_span(s, c, max, first, idx - 1, base, end))
+				return 1;
+
+			base = piece_row_chars(row);
+			end = base + row->size;
+			first = idx;
+			joinable = (row->cap == 0 && base >= eru.pt.orig && end <= eru.pt.orig + eru.pt.orig_len);
+		}
+	}
+
+	return base && eru_find_span(s, c, max, first, idx - 1, base, end);
+}
+
+/**
+ * First row in [lo, hi) with a match, and in *cx the char it starts at,
+ * or -1. The walk ends at the second match; it is only used when there
+ * are too many to cache, so that one is never far off.
+**/
+static int
+eru_find_forward(const struct Search *s, int lo, int hi, int *cx)
+{
+	struct SearchHit hit;
+	struct SearchCache c;
+
+	memset(&c, 0, sizeof(c));
+	c.base = &hit;
+	c.cap = 1;
+
+	eru_find_hits(s, &c, 1, lo, hi);
+
+	if (c.num_base == 0)
+		return -1;
+
+	*cx = hit.cx;
+
+	return hit.row;
+}
+
+/**
+ * Like eru_find_forward() but walking up from row from and wrapping
+ * around at the top; rows are searched one at a time.
+**/
+static int
+eru_find_backward(const struct Search *s, int from, int *cx)
+{
+	Row *row = eru_row(from);
+	int idx = from, i;
+
+	for (i = 0; i < eru.num_rows; i++) {
+		const char *match = search_find(s, piece_row_chars(row), row->size);
+
+		if (match) {
+			*cx = match - row->chars;
+
+			return idx;
+		}
+
+		if (--idx < 0) {
+			idx = eru.num_rows - 1;
+			row = eru_row(idx);
+		} else {
+			row = piece_row_prev(row);
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * Keep those of the n hits in from where the longer query in s still
+ * matches, writing them to to, which may be from. Returns how many.
+**/
+static int
+eru_search_narrow(const struct Search *s, const struct SearchHit *from, int n, struct SearchHit *to)
+{
+	struct RowCursor rc = { NULL, 0, 0 };
+	int i, kept = 0;
+
+	for (i = 0; i < n; i++) {
+		Row *row = eru_row_cursor(&rc, from[i].row);
+		const char *chars = piece_row_chars(row);
+
+		if (search_at(s, chars + from[i].cx, row->size - from[i].cx))
+			to[kept++] = from[i];
+	}
+
+	return kept;
+}
+
+/**
+ * Bring the cache up to date for query, compiled in s. A query that
+ * extends the last one narrows its hits, one that still extends the last
+ * query searched in full narrows those, and anything else is searched
+ * in full. Returns 0 if that found too many hits to keep.
+**/
+static int
+eru_search_update(struct SearchCache *c, const struct Search *s, const char *query)
+{
+	if (c->query && c->flags == eru.search_flags && !strcmp(query, c->query))
+		return c->complete;
+
+	if (c->base_query && c->flags == eru.search_flags && c->complete &&
+		!strncmp(query, c->base_query, strlen(c->base_query))) {
+
+		if (!strncmp(query, c->query, strlen(c->query))) {
+			c->num_hit = eru_search_narrow(s, c->hit, c->num_hit, c->hit);
+		} else if (!strcmp(query, c->base_query)) {
+			memcpy(c->hit, c->base, sizeof(struct SearchHit) * c->num_base);
+			c->num_hit = c->num_base;
+		} else {
+			c->num_hit = eru_search_narrow(s, c->base, c->num_base, c->hit);
+		}
+	} else {
+		free(c->base_query);
+
+		if ((c->base_query = strdup(query)) == NULL)
+			eru_error("[!] ERROR: eru: ");
+
+		c->flags = eru.search_flags;
+		c->complete = !eru_find_hits(s, c, SEARCH_HITS_MAX, 0, eru.num_rows);
+		c->num_hit = c->num_base;
+		c->hit = realloc(c->hit, sizeof(struct SearchHit) * (c->num_base ? c->num_base : 1));
+
+		if (c->hit == NULL)
+			eru_error("[!] ERROR: eru: ");
+
+		memcpy(c->hit, c->base, sizeof(struct SearchHit) * c->num_base);
+	}
+
+	free(c->query);
+
+	if ((c->query = strdup(query)) == NULL)
+		eru_error("[!] ERROR: eru: ");
+
+	return c->complete;
+}
+
+static void
+eru_search_drop(struct SearchCache *c)
+{
+	free(c->base_query);
+	free(c->query);
+	free(c->base);
+	free(c->hit);
+	memset(c, 0, sizeof(struct SearchCache));
+}
+
+/**
+ * While every match fits in the cache the arrows step through the cached
+ * hits and the message bar counts them; past SEARCH_HITS_MAX they step
+ * row by row with a fresh search each time.
+**/
 void
 eru_search_cb(char *query, int key)
 {
+	static struct SearchCache cache;
 	static int last_match = -1;
 	static int direction = 1;
-	static int saved_hl_line;
-	static char *saved_hl = NULL;
+	int curr = -1, cx = 0;
+	char note[48];
 
-	if (saved_hl) {
-		memcpy(eru.row[saved_hl_line].highlight, saved_hl, eru.row[saved_hl_line].rsize);
-		free(saved_hl);
-		saved_hl = NULL;
+	if (eru.match_len > 0) {
+		eru_damage_row(eru.match_row);
+		eru.match_len = 0;
 	}
 
 	if (key == '\r' || key == '\x1b') {
+		eru_search_drop(&cache);
 		last_match = -1;
 		direction = 1;
 
@@ -1184,6 +2449,9 @@ eru_search_cb(char *query, int key)
 	} else if (key == LEFT || key == UP) {
 		direction = -1;
 	} else {
+		if (key == CTRL_KEY('t'))
+			eru.search_flags ^= SEARCH_ICASE;
+
 		last_match = -1;
 		direction = 1;
 	}
@@ -1191,33 +2459,58 @@ eru_search_cb(char *query, int key)
 	if (last_match == -1)
 		direction = 1;
 
-	int curr = last_match;
-	int i;
+	if (eru.num_rows == 0 || query[0] == '\0')
+		return;
 
-	for (i = 0; i < eru.num_rows; i++) {
-		curr *= direction;
+	struct Search s;
 
-		if (curr == -1)
-			curr = eru.num_rows - 1;
-		else if (curr == eru.num_rows)
-			curr = 0;
+	if (search_compile(&s, query, strlen(query), eru.search_flags) == -1)
+		eru_error("[!] ERROR: eru: ");
 
-		Row *row = &eru.row[curr];
-		char *match = strstr(row->render, query);
+	if (eru_search_update(&cache, &s, query)) {
+		if (cache.num_hit > 0) {
+			if (last_match == -1)
+				cache.cur = 0;
+			else
+				cache.cur = (cache.cur + direction + cache.num_hit) % cache.num_hit;
 
-		if (match) {
-			last_match = curr;
-			eru.cur_y = curr;
-			eru.cur_x = eru_row_renx_to_curx(row, match - row->render);
-			eru.row_offset = eru.num_rows;
-
-			saved_hl_line = curr;
-			saved_hl = malloc(row->rsize);
-			
-			memcpy(saved_hl, row->highlight, row->rsize);
-			memset(&row->highlight[match - row->render], HIGHLIGHT_MATCH, strlen(query));
-			break;
+			curr = cache.hit[cache.cur].row;
+			cx = cache.hit[cache.cur].cx;
+			snprintf(note, sizeof(note), "match %d of %d", cache.cur + 1, cache.num_hit);
+		} else {
+			snprintf(note, sizeof(note), "no matches");
 		}
+	} else {
+		int from = last_match + direction;
+
+		if (from < 0)
+			from = eru.num_rows - 1;
+		else if (from >= eru.num_rows)
+			from = 0;
+
+		if (direction == 1) {
+			if ((curr = eru_find_forward(&s, from, eru.num_rows, &cx)) == -1)
+				curr = eru_find_forward(&s, 0, from, &cx);
+		} else {
+			curr = eru_find_backward(&s, from, &cx);
+		}
+
+		snprintf(note, sizeof(note), "over %d matches", SEARCH_HITS_MAX);
+	}
+
+	search_free(&s);
+	eru_set_status_msg("[!] SEARCH: %s [%s%s] " SEARCH_HELP, query, note,
+		(eru.search_flags & SEARCH_ICASE) ? ", any case" : "");
+
+	if (curr != -1) {
+		last_match = curr;
+		eru.cur_y = curr;
+		eru.cur_x = cx;
+		eru.row_offset = eru.num_rows;
+
+		eru.match_row = curr;
+		eru.match_col = eru_row_curx_to_renx(eru_row(curr), cx);
+		eru.match_len = strlen(query);
 	}
 }
 
@@ -1231,16 +2524,50 @@ eru_init(void)
 	eru.col_offset = 0;
 	eru.num_rows = 0;
 	eru.dirty = 0;
+	eru.hl_frontier = 0;
+	eru.match_row = 0;
+	eru.match_len = 0;
+	eru.search_flags = 0;
+	eru.frame_row_offset = 0;
+	eru.frame_col_offset = 0;
+	eru.frames = 0;
+	eru.frame_bytes = 0;
+	eru.total_bytes = 0;
+	eru.frame = (struct AppendBuffer)ABUF_INIT;
 	eru.filename = NULL;
 	eru.status_msg[0] = '\0';
 	eru.status_msg_time = 0;
-	eru.row = NULL;
+	eru.msg_timer = -1;
 	eru.syntax = NULL;
+	arena_init(&eru.arena);
+	piece_init(&eru.pt, &eru.arena);
+	input_init(&eru.input, STDIN_FILENO);
+
+	if (event_init(&eru.events, STDIN_FILENO) == -1)
+		eru_error("[!] ERROR: eru: ");
+
+	event_idle(&eru.events, eru_idle_highlight, NULL);
+
+	if (history_init(&eru.history, HISTORY_BUDGET) == -1)
+		eru_error("[!] ERROR: eru: ");
 
 	if (get_window_size(&eru.screen_rows, &eru.screen_cols) == -1)
 		eru_error("[!] ERROR: eru: ");
 
 	eru.screen_rows -= 2;
+
+	if ((eru.damage = malloc(eru.screen_rows)) == NULL)
+		eru_error("[!] ERROR: eru: ");
+
+	if (screen_init(&eru.screen, eru.screen_rows + 2, eru.screen_cols) == -1)
+		eru_error("[!] ERROR: eru: ");
+
+	char *term = getenv("TERM");
+
+	if (term == NULL || !strcmp(term, "dumb"))
+		eru.screen.can_scroll = 0;
+
+	eru_damage_all();
 }
 
 int
@@ -1256,7 +2583,17 @@ main(int argc, char *argv[])
 
 	for (;;) {
 		eru_clear_screen();
-		eru_process_keypress();
+
+		int ev = event_wait(&eru.events);
+
+		if (ev == -1)
+			eru_error("[!] ERROR: eru: ");
+
+		if (ev & EVENT_RESIZE)
+			eru_resize();
+
+		while (eru_key_ready())
+			eru_process_keypress();
 	}
 
 	return 0;
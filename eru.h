@@ -26,20 +26,36 @@
 #include <termios.h>
 #include <errno.h>
 
+#include "arena.h"
+#include "event.h"
 #include "history.h"
+#include "input.h"
+#include "lexer.h"
+#include "piece.h"
 #include "point.h"
+#include "scan.h"
+#include "search.h"
+#include "screen.h"
 
 #define ERU_VERSION "0.0.5"
 #define TAB_STOP 8
 #define BUFFER_NAME_MAX 16
 #define QUIT_TIMES 3
+#define SAVE_IOV_MAX 1024
+#define MSG_TIMEOUT 5000
+#define IDLE_HL_ROWS 512
+#define IDLE_HL_AHEAD 8192
+#define HL_PARALLEL_MIN 65536
+#define HL_MAX_THREADS 16
+#define SEARCH_HITS_MAX (1 << 20)
+#define SEARCH_HELP "(Arrows, Enter, Ctrl-T case, ESC)"
 #define DEBUG_MODE 1
-#define HIGHLIGHT_NUMBERS (1 << 0)
-#define HIGHLIGHT_STRINGS (1 << 1)
+#define ROW_RENDER (1 << 0)
+#define ROW_HL (1 << 1)
+#define ROW_LEX (1 << 2)
 #define HLDB_ENTRIES (sizeof(hldb) / sizeof(hldb[0]))
 
 #define CTRL_KEY(k) ((k) & 0x1F)
-#define ABUF_INIT {NULL, 0}
 
 const char *BLACK 									= "\x1b[30m";
 const char *RED 										= "\x1b[31m";
@@ -69,45 +85,11 @@ const char *TERM_SHOW_CUR						= "\x1b[?25h";
 const char *TERM_MOVE_CUR_DEFAULT 	= "\x1b[H";
 const char *TERM_QUERY_CUR_POS			= "\x1b[6n";
 
-enum eru_key {
-	SPACE = 32,
-	BACKSPACE = 127,
-	LEFT = 1000,
-	RIGHT,
-	UP,
-	DOWN,
-	PAGE_UP,
-	PAGE_DOWN,
-	HOME,
-	END,
-	DELETE,
-};
-
-enum eru_highlight {
-	HIGHLIGHT_NORMAL = 0,
-	HIGHLIGHT_COMMENT,
-	HIGHLIGHT_ML_COMMENT,
-	HIGHLIGHT_STRING,
-	HIGHLIGHT_NUMBER,
-	HIGHLIGHT_MATCH,
-	HIGHLIGHT_KEYW1,
-	HIGHLIGHT_KEYW2,
-};
-
 enum editor_mode {
 	MODE_NORMAL,
 	MODE_INSERT,
 };
 
-typedef struct Row {
-	int idx;
-	int size, rsize;
-	int hl_open_comment;
-	char *chars;
-	char *render;
-	unsigned char *highlight;
-} Row;
-
 struct Editor {
 	struct termios orig;
 	int cur_x, cur_y;
@@ -117,19 +99,46 @@ struct Editor {
 	int row_offset;
 	int col_offset;
 	int dirty;
+	int hl_frontier;
+	int match_row, match_col, match_len;
+	int search_flags;
+	int frame_row_offset, frame_col_offset;
+	unsigned char *damage;
+	unsigned long frames, frame_bytes, total_bytes;
+	struct AppendBuffer frame;
 	int mode;
 	char filename;
 	char status_msg[80];
 	time_t status_msg_time;
+	int msg_timer;
 	struct Syntax *syntax;
-	struct Editor *prev;
-	struct Editor *next;
-	Row *row;
+	struct Arena arena;
+	struct History history;
+	struct PieceTable pt;
+	struct Screen screen;
+	struct Input input;
+	struct EventLoop events;
 };
 
-struct AppendBuffer {
-	char *buf;
-	int len;
+struct SearchHit {
+	int row, cx;
+};
+
+/**
+ * Every match of the query being typed, in document order. base holds
+ * the hits of base_query, the last query searched in full, and hit those
+ * of query, which extends it. Typing a character narrows hit; erasing
+ * back to no shorter than base_query narrows base again. Only a query
+ * that doesn't start with base_query costs a new pass over the text.
+ * complete is 0 when that pass gave up past SEARCH_HITS_MAX.
+**/
+struct SearchCache {
+	char *base_query, *query;
+	int flags;
+	int complete;
+	struct SearchHit *base, *hit;
+	int num_base, num_hit, cap;
+	int cur;
 };
 
 struct Syntax {
@@ -140,6 +149,7 @@ struct Syntax {
 	char *mline_comment_end;
 	char **keywords;
 	int flags;
+	struct Lexer *lex;
 };
 
 typedef struct Buffer {
@@ -175,25 +185,35 @@ void disable_raw_mode(void);
 void enable_raw_mode(void);
 
 void eru_open(char *);
+void eru_close(void);
 void eru_save(void);
+int eru_save_file(const char *, size_t *, size_t *);
 void eru_scroll(void);
-void eru_draw_rows(struct AppendBuffer *);
+void eru_draw_rows(void);
+void eru_damage_row(int);
+void eru_damage_from(int);
+void eru_damage_all(void);
+void eru_damage_scroll(int);
 void eru_clear_screen(void);
 int eru_read_key(void);
+int eru_key_ready(void);
+void eru_resize(void);
+void eru_msg_expire(void *);
+int eru_idle_highlight(void *);
 
+Row *eru_row(int);
+Row *eru_row_ready(int);
 void eru_insert_row(int, char *, size_t len);
 void eru_update_row(Row *);
+void eru_render_row(Row *);
 int eru_row_curx_to_renx(Row *, int);
 int eru_row_renx_to_curx(Row *, int);
-char *eru_rows_to_string(int *);
+int eru_row_hl_at(const Row *, int);
 void eru_row_append_string(Row *, char *, size_t);
 
-void eru_draw_status_bar(struct AppendBuffer *);
+void eru_draw_status_bar(void);
 void eru_set_status_msg(const char *, ...);
-void eru_draw_msg_bar(struct AppendBuffer *);
-
-void abuf_append(struct AppendBuffer *, const char *, int);
-void abuf_free(struct AppendBuffer *);
+void eru_draw_msg_bar(void);
 
 int buffer_create(char *buf_name);
 int buffer_clear(Buffer *buf);
@@ -208,9 +228,9 @@ int get_cursor_position(int *, int *);
 
 int eru_syntax_colored(int);
 void eru_select_syntax_highlight(void);
-void eru_update_syntax(Row *);
+void eru_update_syntax(Row *, int);
+void eru_lex_all(void);
 
-int is_separator(int);
 void eru_process_keypress(void);
 void eru_move_cursor(int);
 
@@ -222,6 +242,14 @@ void eru_insert_char(int);
 void eru_free_row(Row *);
 void eru_del_row(int);
 void eru_insert_newline(void);
+void eru_insert_text(Point, const char *, size_t);
+void eru_paste(void);
+void eru_delete_text(Point, size_t);
+
+void eru_record(int, Point, const char *, size_t, Point);
+void eru_undo(void);
+void eru_redo(void);
+void eru_redo_branch(void);
 
 char *eru_prompt(char *, void (char *, int));
 void eru_search(void);
@@ -0,0 +1,201 @@
+/**
+ * ERU: A simple, lightweight, portable text editor for POSIX systems.
+ *
+ * Copyright (C) 2021, Eric Londo <londoed@comcast.net>, { event.c }.
+ * This software is distributed under the GNU General Public License Version 2.0.
+ * Refer to the file LICENSE for additional details.
+**/
+
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "event.h"
+
+static int event_sig_fd = -1;
+
+static long long
+event_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static void
+event_on_signal(int sig)
+{
+	int saved = errno;
+	char c = sig;
+
+	if (write(event_sig_fd, &c, 1) == -1)
+		errno = saved;
+
+	errno = saved;
+}
+
+int
+event_init(struct EventLoop *loop, int fd)
+{
+	struct sigaction sa;
+	int i;
+
+	memset(loop, 0, sizeof(struct EventLoop));
+	loop->fd = fd;
+
+	if (pipe(loop->sig_pipe) == -1)
+		return -1;
+
+	for (i = 0; i < 2; i++) {
+		fcntl(loop->sig_pipe[i], F_SETFL, fcntl(loop->sig_pipe[i], F_GETFL) | O_NONBLOCK);
+		fcntl(loop->sig_pipe[i], F_SETFD, FD_CLOEXEC);
+	}
+
+	event_sig_fd = loop->sig_pipe[1];
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = event_on_signal;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+
+	return sigaction(SIGWINCH, &sa, NULL);
+}
+
+/**
+ * Call fn once, ms milliseconds from now. Returns a timer id for
+ * event_cancel(), or -1 if every slot is taken.
+**/
+int
+event_timer(struct EventLoop *loop, int ms, void (*fn)(void *), void *arg)
+{
+	int i;
+
+	for (i = 0; i < EVENT_TIMERS; i++) {
+		if (loop->timers[i].fn == NULL) {
+			loop->timers[i].deadline = event_now() + ms;
+			loop->timers[i].fn = fn;
+			loop->timers[i].arg = arg;
+
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+void
+event_cancel(struct EventLoop *loop, int id)
+{
+	if (id >= 0 && id < EVENT_TIMERS)
+		loop->timers[id].fn = NULL;
+}
+
+int
+event_idle(struct EventLoop *loop, int (*fn)(void *), void *arg)
+{
+	if (loop->num_idle == EVENT_IDLE)
+		return -1;
+
+	loop->idle[loop->num_idle].fn = fn;
+	loop->idle[loop->num_idle].arg = arg;
+	loop->num_idle++;
+	loop->idle_busy = 1;
+
+	return 0;
+}
+
+/**
+ * Tell the loop there may be idle work again, e.g. after an edit.
+**/
+void
+event_kick(struct EventLoop *loop)
+{
+	loop->idle_busy = (loop->num_idle > 0);
+}
+
+static int
+event_run_timers(struct EventLoop *loop, long long now, int *timeout)
+{
+	int fired = 0, i;
+
+	for (i = 0; i < EVENT_TIMERS; i++) {
+		struct Timer *t = &loop->timers[i];
+
+		if (t->fn == NULL)
+			continue;
+
+		if (t->deadline <= now) {
+			void (*fn)(void *) = t->fn;
+
+			t->fn = NULL;
+			fn(t->arg);
+			fired = 1;
+		} else if (*timeout == -1 || t->deadline - now < *timeout) {
+			*timeout = t->deadline - now;
+		}
+	}
+
+	return fired;
+}
+
+/**
+ * Block until there is input, a resize or a due timer, and say which with
+ * EVENT_* flags. Idle slices run only while poll() finds nothing ready, so
+ * a key is never kept waiting longer than one slice.
+**/
+int
+event_wait(struct EventLoop *loop)
+{
+	for (;;) {
+		struct pollfd pfd[2] = {
+			{ loop->fd, POLLIN, 0 },
+			{ loop->sig_pipe[0], POLLIN, 0 },
+		};
+		int timeout = -1, ev = 0, i;
+
+		if (event_run_timers(loop, event_now(), &timeout))
+			return EVENT_TIMER;
+
+		if (loop->idle_busy)
+			timeout = 0;
+
+		if (poll(pfd, 2, timeout) == -1) {
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		if (pfd[1].revents & POLLIN) {
+			char buf[64];
+
+			while (read(loop->sig_pipe[0], buf, sizeof(buf)) > 0)
+				;
+
+			ev |= EVENT_RESIZE;
+		}
+
+		if (pfd[0].revents & (POLLIN | POLLHUP))
+			ev |= EVENT_INPUT;
+
+		if (ev) {
+			event_kick(loop);
+			return ev;
+		}
+
+		if (loop->idle_busy) {
+			loop->idle_busy = 0;
+
+			for (i = 0; i < loop->num_idle; i++)
+				loop->idle_busy |= loop->idle[i].fn(loop->idle[i].arg) != 0;
+		}
+	}
+}
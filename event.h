@@ -0,0 +1,50 @@
+/**
+ * ERU: A simple, lightweight, portable text editor for POSIX systems.
+ *
+ * Copyright (C) 2021, Eric Londo <londoed@comcast.net>, { event.h }.
+ * This software is distributed under the GNU General Public License Version 2.0.
+ * Refer to the file LICENSE for additional details.
+**/
+
+#ifndef EVENT_H
+#define EVENT_H
+
+#define EVENT_TIMERS 8
+#define EVENT_IDLE 8
+#define EVENT_INPUT (1 << 0)
+#define EVENT_RESIZE (1 << 1)
+#define EVENT_TIMER (1 << 2)
+
+struct Timer {
+	long long deadline;
+	void (*fn)(void *);
+	void *arg;
+};
+
+struct Idle {
+	int (*fn)(void *);
+	void *arg;
+};
+
+/**
+ * Waits on the terminal, a self-pipe fed by SIGWINCH and the nearest timer
+ * deadline. While nothing is pending the idle tasks get slices of work;
+ * each returns nonzero as long as it has more to do.
+**/
+struct EventLoop {
+	int fd;
+	int sig_pipe[2];
+	struct Timer timers[EVENT_TIMERS];
+	struct Idle idle[EVENT_IDLE];
+	int num_idle;
+	int idle_busy;
+};
+
+int event_init(struct EventLoop *, int);
+int event_timer(struct EventLoop *, int, void (*)(void *), void *);
+void event_cancel(struct EventLoop *, int);
+int event_idle(struct EventLoop *, int (*)(void *), void *);
+void event_kick(struct EventLoop *);
+int event_wait(struct EventLoop *);
+
+#endif
@@ -6,86 +6,307 @@
  * Refer to the file LICENSE for additional details.
 **/
 
-#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "history.h"
 
-History hist;
+/**
+ * Start an empty log whose root is the state the document is in now.
+**/
+int
+history_init(struct History *h, size_t budget)
+{
+	memset(h, 0, sizeof(struct History));
+	h->budget = budget;
+
+	if ((h->root = calloc(1, sizeof(struct HistoryNode))) == NULL)
+		return -1;
+
+	h->current = h->root;
+	h->saved = h->root;
+	h->bytes = sizeof(struct HistoryNode);
+
+	return 0;
+}
+
+static void
+history_free_node(struct History *h, struct HistoryNode *node)
+{
+	h->bytes -= sizeof(struct HistoryNode) + node->cap;
+
+	if (h->saved == node)
+		h->saved = NULL;
+
+	free(node->text);
+	free(node);
+}
 
-Editor
-*editor_copy(Editor *old_ed)
+/**
+ * Free node and everything below it. Walks down the first-child links and
+ * frees on the way back up, so a long linear history needs no recursion.
+**/
+static void
+history_free_tree(struct History *h, struct HistoryNode *node)
 {
-	Editor *ed = malloc(sizeof(Editor));
-
-	ed->cur_x 										= old_ed->cur_x;
-	ed->cur_y 										= old_ed->cur_y;
-	ed->ren_x 										= old_ed->ren_x;
-	ed->row_offset 								= old_ed->row_offset;
-	ed->col_offset 								= old_ed->col_offset;
-
-	ed->screen_rows 							= old_ed->screen_rows;
-	ed->screen_cols 							= old_ed->screen_cols;
-	ed->dirty 										= old_ed->dirty;
-	ed->num_rows 									= old_ed->num_rows;
-
-	ed->filename									= old_ed->filename;
-	ed->status_msg_time						= old_ed->status_msg_time;
-	ed->syntax										= old_ed->syntax;
-	ed->orig											= old_ed->orig;
-	ed->mode											= old_ed->mode;
-	ed->status_msg[0]							= *old_ed->status_msg;
-
-	ed->row = malloc(sizeof(Row) * (old_ed->num_rows));
-	int i;
-
-	for (i = 0; i < ed->num_rows; i++) {
-		ed->row[i].idx = old_ed->row[i].idx;
-		ed->row[i].size = old_ed->row[i].size;
-		ed->row[i].rsize = old_ed->row[i].rsize;
-		ed->row[i].hl_open_comment = old_ed->row[i].hl_open_comment;
-
-		ed->row[i].chars = malloc(old_ed->row[i].size);
-		memcpy(ed->row[i].chars, old_ed->row[i].chars, old_ed->row[i].size);
-
-		ed->row[i].render = malloc(old_ed->row[i].rsize);
-		memcpy(ed->row[i].render, old_ed->row[i].render, old_ed->row[i].rsize);
-
-		ed->row[i].highlight = malloc(old_ed->row[i].risze);
-		memcpy(ed->row[i].highlight, old_ed->row[i].highlight, old_ed->row[i].rsize);
+	struct HistoryNode *n = node;
+
+	while (n) {
+		if (n->child) {
+			n = n->child;
+			continue;
+		}
+
+		struct HistoryNode *parent = (n == node) ? NULL : n->parent;
+
+		if (parent)
+			parent->child = n->next;
+
+		history_free_node(h, n);
+		n = parent;
 	}
+}
+
+void
+history_free(struct History *h)
+{
+	if (h->root)
+		history_free_tree(h, h->root);
 
-	return ed;
+	memset(h, 0, sizeof(struct History));
 }
 
-struct Editor *
-editor_history_push(struct Editor *snapshot)
+/**
+ * Drop the oldest changes until the log fits its byte budget. The child
+ * of the root leading to the current state becomes the new root, and the
+ * branches that forked off before it go with the old one.
+**/
+static void
+history_trim(struct History *h)
 {
-	Editor *ed = editor_copy(snapshot);
+	while (h->bytes > h->budget && h->root != h->current) {
+		struct HistoryNode *root = h->root;
+		struct HistoryNode *keep = h->current;
+
+		while (keep->parent != root)
+			keep = keep->parent;
 
-	snapshot->redo = ed;
-	ed->undo = snapshot;
+		while (root->child) {
+			struct HistoryNode *c = root->child;
 
-	return new_e;
+			root->child = c->next;
+
+			if (c != keep)
+				history_free_tree(h, c);
+		}
+
+		history_free_node(h, root);
+
+		h->bytes -= keep->cap;
+		free(keep->text);
+		keep->text = NULL;
+		keep->len = keep->cap = 0;
+		keep->parent = NULL;
+		keep->next = NULL;
+		h->root = keep;
+	}
 }
 
-struct Editor *
-editor_history_undo(struct Editor *ed)
+static int
+history_grow(struct History *h, struct HistoryNode *node, size_t need)
 {
-	if (ed->undo)
-		return ed->undo;
+	if (node->len + need <= node->cap)
+		return 0;
+
+	size_t cap = node->cap ? node->cap * 2 : 16;
+
+	while (cap < node->len + need)
+		cap *= 2;
 
-	return ed;
+	char *text = realloc(node->text, cap);
+
+	if (text == NULL)
+		return -1;
+
+	h->bytes += cap - node->cap;
+	node->text = text;
+	node->cap = cap;
+
+	return 0;
 }
 
-struct Editor *
-editor_history_redo(struct Editor *ed)
+/**
+ * Fold a single-line edit into the current node when it continues it:
+ * typing right after the last insert, or deleting next to the last delete
+ * in either direction.
+**/
+static int
+history_extend(struct History *h, int type, Point at, const char *text, size_t len)
 {
-	if (ed->redo)
-		return ed->redo;
+	struct HistoryNode *node = h->current;
+
+	if (!h->open || node == h->root || node->type != type || at.y != node->at.y)
+		return 0;
 
-	return ed;
+	if (memchr(text, '\n', len))
+		return 0;
+
+	if (type == HISTORY_INSERT && at.x == node->at.x + (int)node->len) {
+		if (history_grow(h, node, len) == -1)
+			return -1;
+
+		memcpy(&node->text[node->len], text, len);
+	} else if (type == HISTORY_DELETE && at.x == node->at.x) {
+		if (history_grow(h, node, len) == -1)
+			return -1;
+
+		memcpy(&node->text[node->len], text, len);
+	} else if (type == HISTORY_DELETE && at.x + (int)len == node->at.x) {
+		if (history_grow(h, node, len) == -1)
+			return -1;
+
+		memmove(&node->text[len], node->text, node->len);
+		memcpy(node->text, text, len);
+		node->at = at;
+	} else {
+		return 0;
+	}
+
+	node->len += len;
+
+	return 1;
 }
 
+/**
+ * Log an edit that has just been applied. before and after are the cursor
+ * positions around it, restored by undo and redo respectively.
+**/
+int
+history_record(struct History *h, int type, Point at, const char *text, size_t len, Point before, Point after)
+{
+	int ret = history_extend(h, type, at, text, len);
+
+	if (ret == -1)
+		return -1;
+
+	if (ret == 0) {
+		struct HistoryNode *node = calloc(1, sizeof(struct HistoryNode));
 
+		if (node == NULL)
+			return -1;
+
+		h->bytes += sizeof(struct HistoryNode);
+
+		if (history_grow(h, node, len) == -1) {
+			history_free_node(h, node);
+			return -1;
+		}
+
+		memcpy(node->text, text, len);
+		node->len = len;
+		node->type = type;
+		node->at = at;
+		node->before = before;
+		node->parent = h->current;
+		node->next = h->current->child;
+		h->current->child = node;
+		h->current->redo = node;
+		h->current = node;
+	}
+
+	h->current->after = after;
+	h->open = (memchr(text, '\n', len) == NULL);
+	history_trim(h);
+
+	return 0;
+}
+
+/**
+ * End the current run of typing, so the next edit starts a new change.
+**/
+void
+history_seal(struct History *h)
+{
+	h->open = 0;
+}
+
+void
+history_mark_saved(struct History *h)
+{
+	h->saved = h->current;
+	h->open = 0;
+}
+
+int
+history_is_saved(const struct History *h)
+{
+	return h->current == h->saved;
+}
+
+/**
+ * Step back over the current change and return it for the caller to
+ * revert, or NULL at the oldest state.
+**/
+const struct HistoryNode *
+history_undo(struct History *h)
+{
+	struct HistoryNode *node = h->current;
+
+	if (node == h->root)
+		return NULL;
+
+	node->parent->redo = node;
+	h->current = node->parent;
+	h->open = 0;
+
+	return node;
+}
+
+/**
+ * Step forward along the selected branch and return the change for the
+ * caller to reapply, or NULL when there is nothing to redo.
+**/
+const struct HistoryNode *
+history_redo(struct History *h)
+{
+	struct HistoryNode *node = h->current->redo;
+
+	if (node == NULL)
+		return NULL;
+
+	h->current = node;
+	h->open = 0;
+
+	return node;
+}
+
+/**
+ * Point redo at the next branch below the current state, wrapping around.
+ * Returns its 1-based position among the *count branches, or 0 if none.
+**/
+int
+history_branch(struct History *h, int *count)
+{
+	struct HistoryNode *cur = h->current;
+	struct HistoryNode *c;
+	int n = 0, pos = 0;
+
+	for (c = cur->child; c; c = c->next)
+		n++;
+
+	*count = n;
+
+	if (n == 0)
+		return 0;
+
+	cur->redo = (cur->redo && cur->redo->next) ? cur->redo->next : cur->child;
+
+	for (c = cur->child; c; c = c->next) {
+		pos++;
+
+		if (c == cur->redo)
+			break;
+	}
+
+	return pos;
+}
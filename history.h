@@ -9,11 +9,52 @@
 #ifndef HISTORY_H
 #define HISTORY_H
 
-#include "eru.h"
+#include <stddef.h>
 
-typedef struct History {
-	Editor *buffer[5];
-	int size;
-} History;
+#include "point.h"
+
+#define HISTORY_BUDGET (32 * 1024 * 1024)
+
+enum history_op {
+	HISTORY_INSERT,
+	HISTORY_DELETE,
+};
+
+/**
+ * One primitive edit: len bytes of text inserted at, or deleted from, a
+ * point, with '\n' standing for a line break. Undo replays its inverse.
+ *
+ * Nodes form a tree rooted at the oldest state still reachable. An edit
+ * made after an undo starts a new branch instead of discarding the old
+ * one, and redo follows whichever branch was last taken.
+**/
+struct HistoryNode {
+	struct HistoryNode *parent;
+	struct HistoryNode *child, *next;
+	struct HistoryNode *redo;
+	int type;
+	Point at;
+	Point before, after;
+	size_t len, cap;
+	char *text;
+};
+
+struct History {
+	struct HistoryNode *root;
+	struct HistoryNode *current;
+	struct HistoryNode *saved;
+	size_t bytes, budget;
+	int open;
+};
+
+int history_init(struct History *, size_t);
+void history_free(struct History *);
+int history_record(struct History *, int, Point, const char *, size_t, Point, Point);
+void history_seal(struct History *);
+void history_mark_saved(struct History *);
+int history_is_saved(const struct History *);
+const struct HistoryNode *history_undo(struct History *);
+const struct HistoryNode *history_redo(struct History *);
+int history_branch(struct History *, int *);
 
 #endif
@@ -0,0 +1,249 @@
+/**
+ * ERU: A simple, lightweight, portable text editor for POSIX systems.
+ *
+ * Copyright (C) 2021, Eric Londo <londoed@comcast.net>, { input.c }.
+ * This software is distributed under the GNU General Public License Version 2.0.
+ * Refer to the file LICENSE for additional details.
+**/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "input.h"
+
+#define INPUT_MASK (INPUT_RING - 1)
+#define INPUT_AT(in, i) ((in)->ring[((in)->head + (i)) & INPUT_MASK])
+
+/**
+ * Escape sequences, without the leading ESC, and the keys they stand for.
+**/
+static const struct {
+	const char *seq;
+	int key;
+} input_seqs[] = {
+	{ "[A", UP },
+	{ "[B", DOWN },
+	{ "[C", RIGHT },
+	{ "[D", LEFT },
+	{ "[H", HOME },
+	{ "[F", END },
+	{ "OH", HOME },
+	{ "OF", END },
+	{ "[1~", HOME },
+	{ "[3~", DELETE },
+	{ "[4~", END },
+	{ "[5~", PAGE_UP },
+	{ "[6~", PAGE_DOWN },
+	{ "[7~", HOME },
+	{ "[8~", END },
+	{ "[200~", PASTE_START },
+	{ "[201~", PASTE_END },
+};
+
+void
+input_init(struct Input *in, int fd)
+{
+	in->fd = fd;
+	in->head = 0;
+	in->tail = 0;
+}
+
+size_t
+input_pending(const struct Input *in)
+{
+	return in->tail - in->head;
+}
+
+/**
+ * Wait up to timeout milliseconds, -1 for ever, for input and read all
+ * that is available into the ring in one go. Returns the number of bytes
+ * read, 0 on timeout or a full ring, or -1 on error.
+**/
+int
+input_fill(struct Input *in, int timeout)
+{
+	struct pollfd pfd = { in->fd, POLLIN, 0 };
+	size_t room = INPUT_RING - input_pending(in);
+	size_t off = in->tail & INPUT_MASK;
+	ssize_t n;
+
+	if (room == 0)
+		return 0;
+
+	if (room > INPUT_RING - off)
+		room = INPUT_RING - off;
+
+	if (poll(&pfd, 1, timeout) == -1)
+		return (errno == EINTR) ? 0 : -1;
+
+	if (!(pfd.revents & (POLLIN | POLLHUP)))
+		return 0;
+
+	n = read(in->fd, &in->ring[off], room);
+
+	if (n == -1)
+		return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+
+	in->tail += n;
+
+	return n;
+}
+
+/**
+ * Skip a CSI sequence nobody asked for, up to and including its final byte.
+**/
+static int
+input_skip_csi(struct Input *in, size_t avail, int final)
+{
+	size_t i;
+
+	for (i = 2; i < avail; i++) {
+		unsigned char c = INPUT_AT(in, i);
+
+		if (c >= 0x40 && c <= 0x7e) {
+			in->head += i + 1;
+			return 1;
+		}
+	}
+
+	if (!final)
+		return 0;
+
+	in->head += avail;
+
+	return 1;
+}
+
+/**
+ * Decode the next key from the ring into *key. Returns 0 if the ring holds
+ * only part of an escape sequence; with final set, that part is taken as
+ * a bare ESC instead. Unknown sequences decode to ESC as well.
+**/
+int
+input_key(struct Input *in, int *key, int final)
+{
+	size_t avail = input_pending(in);
+	size_t i, j;
+	int partial = 0;
+
+	if (avail == 0)
+		return 0;
+
+	if (INPUT_AT(in, 0) != '\x1b') {
+		*key = INPUT_AT(in, 0);
+		in->head++;
+
+		return 1;
+	}
+
+	for (i = 0; i < sizeof(input_seqs) / sizeof(input_seqs[0]); i++) {
+		const char *seq = input_seqs[i].seq;
+		size_t len = strlen(seq);
+
+		for (j = 0; j < len && j + 1 < avail; j++) {
+			if (INPUT_AT(in, j + 1) != (unsigned char)seq[j])
+				break;
+		}
+
+		if (j == len) {
+			*key = input_seqs[i].key;
+			in->head += len + 1;
+
+			return 1;
+		}
+
+		if (j + 1 == avail)
+			partial = 1;
+	}
+
+	if (partial && !final)
+		return 0;
+
+	*key = '\x1b';
+
+	if (avail > 1 && INPUT_AT(in, 1) == '[')
+		return input_skip_csi(in, avail, final);
+
+	in->head++;
+
+	return 1;
+}
+
+/**
+ * Collect a bracketed paste, whose start marker was just decoded, into a
+ * malloc'd buffer up to the end marker. The ring is copied out a run at a
+ * time rather than decoded key by key. Terminals send line breaks as
+ * '\r', so CR and CRLF come back as '\n'.
+**/
+int
+input_paste(struct Input *in, char **text, size_t *len)
+{
+	size_t mark = strlen(INPUT_PASTE_END);
+	size_t cap = 4096, n = 0, i, j;
+	char *buf = malloc(cap);
+	char *hit;
+
+	if (buf == NULL)
+		return -1;
+
+	for (;;) {
+		size_t avail = input_pending(in);
+		size_t off = in->head & INPUT_MASK;
+
+		if (avail == 0) {
+			if (input_fill(in, -1) == -1)
+				goto fail;
+
+			continue;
+		}
+
+		if (avail > INPUT_RING - off)
+			avail = INPUT_RING - off;
+
+		if (n + avail > cap) {
+			while (cap < n + avail)
+				cap *= 2;
+
+			char *new_buf = realloc(buf, cap);
+
+			if (new_buf == NULL)
+				goto fail;
+
+			buf = new_buf;
+		}
+
+		size_t from = (n > mark) ? n - mark : 0;
+
+		memcpy(&buf[n], &in->ring[off], avail);
+		in->head += avail;
+		n += avail;
+
+		if ((hit = memmem(&buf[from], n - from, INPUT_PASTE_END, mark)) != NULL) {
+			in->head -= n - (hit - buf + mark);
+			n = hit - buf;
+			break;
+		}
+	}
+
+	for (i = 0, j = 0; i < n; i++) {
+		if (buf[i] != '\r')
+			buf[j++] = buf[i];
+		else if (i + 1 == n || buf[i + 1] != '\n')
+			buf[j++] = '\n';
+	}
+
+	*text = buf;
+	*len = j;
+
+	return 0;
+
+fail:
+	free(buf);
+
+	return -1;
+}
@@ -0,0 +1,50 @@
+/**
+ * ERU: A simple, lightweight, portable text editor for POSIX systems.
+ *
+ * Copyright (C) 2021, Eric Londo <londoed@comcast.net>, { input.h }.
+ * This software is distributed under the GNU General Public License Version 2.0.
+ * Refer to the file LICENSE for additional details.
+**/
+
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stddef.h>
+
+#define INPUT_RING (64 * 1024)
+#define INPUT_ESC_WAIT 50
+#define INPUT_PASTE_END "\x1b[201~"
+
+enum eru_key {
+	SPACE = 32,
+	BACKSPACE = 127,
+	LEFT = 1000,
+	RIGHT,
+	UP,
+	DOWN,
+	PAGE_UP,
+	PAGE_DOWN,
+	HOME,
+	END,
+	DELETE,
+	PASTE_START,
+	PASTE_END,
+};
+
+/**
+ * Terminal input read in bulk into a ring and decoded into keys from it.
+ * head and tail only ever grow; they are masked when indexing the ring.
+**/
+struct Input {
+	int fd;
+	size_t head, tail;
+	unsigned char ring[INPUT_RING];
+};
+
+void input_init(struct Input *, int);
+int input_fill(struct Input *, int);
+size_t input_pending(const struct Input *);
+int input_key(struct Input *, int *, int);
+int input_paste(struct Input *, char **, size_t *);
+
+#endif
@@ -0,0 +1,137 @@
+/**
+ * ERU: A simple, lightweight, portable text editor for POSIX systems.
+ *
+ * Copyright (C) 2021, Eric Londo <londoed@comcast.net>, { keyword.c }.
+ * This software is distributed under the GNU General Public License Version 2.0.
+ * Refer to the file LICENSE for additional details.
+**/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "keyword.h"
+
+#define KEYWORD_SEEDS 256
+#define KEYWORD_LEN_MAX 255
+
+static unsigned int
+keyword_hash(const char *s, int len, unsigned int seed)
+{
+	unsigned int h = 2166136261u ^ seed;
+	int i;
+
+	for (i = 0; i < len; i++) {
+		h ^= (unsigned char)s[i];
+		h *= 16777619u;
+	}
+
+	return h ^ (h >> 15);
+}
+
+/**
+ * Try to place every word with this seed; fails on the first collision.
+**/
+static int
+keyword_place(struct Keywords *kw, char **words, unsigned int seed)
+{
+	int i;
+
+	memset(kw->slot, 0, sizeof(struct KeywordSlot) * (kw->mask + 1));
+
+	for (i = 0; words[i]; i++) {
+		int len = strlen(words[i]);
+		int type = KEYWORD_1;
+
+		if (len > 1 && words[i][len - 1] == '_') {
+			type = KEYWORD_2;
+			len--;
+		}
+
+		struct KeywordSlot *s = &kw->slot[keyword_hash(words[i], len, seed) & kw->mask];
+
+		if (s->word != NULL) {
+			if (s->len == len && !memcmp(s->word, words[i], len))
+				continue;
+
+			return -1;
+		}
+
+		s->word = words[i];
+		s->len = len;
+		s->type = type;
+	}
+
+	kw->seed = seed;
+
+	return 0;
+}
+
+int
+keyword_compile(struct Keywords *kw, char **words)
+{
+	unsigned int size = 8, seed;
+	int n = 0, i;
+
+	memset(kw, 0, sizeof(struct Keywords));
+
+	for (i = 0; words && words[i]; i++) {
+		int len = strlen(words[i]);
+
+		if (len > KEYWORD_LEN_MAX)
+			return -1;
+
+		if (len > kw->max_len)
+			kw->max_len = len;
+
+		n++;
+	}
+
+	if (n == 0)
+		return 0;
+
+	while (size < (unsigned int)n * 2)
+		size *= 2;
+
+	for (;;) {
+		struct KeywordSlot *slot = realloc(kw->slot, sizeof(struct KeywordSlot) * size);
+
+		if (slot == NULL) {
+			keyword_free(kw);
+			return -1;
+		}
+
+		kw->slot = slot;
+		kw->mask = size - 1;
+
+		for (seed = 0; seed < KEYWORD_SEEDS; seed++) {
+			if (keyword_place(kw, words, seed) == 0)
+				return 0;
+		}
+
+		size *= 2;
+	}
+}
+
+/**
+ * Look up the word of len chars at s. Returns its KEYWORD_* type.
+**/
+int
+keyword_find(const struct Keywords *kw, const char *s, int len)
+{
+	if (kw->slot == NULL || len == 0 || len > kw->max_len)
+		return KEYWORD_NONE;
+
+	const struct KeywordSlot *slot = &kw->slot[keyword_hash(s, len, kw->seed) & kw->mask];
+
+	if (slot->word && slot->len == len && !memcmp(slot->word, s, len))
+		return slot->type;
+
+	return KEYWORD_NONE;
+}
+
+void
+keyword_free(struct Keywords *kw)
+{
+	free(kw->slot);
+	memset(kw, 0, sizeof(struct Keywords));
+}
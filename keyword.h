@@ -0,0 +1,38 @@
+/**
+ * ERU: A simple, lightweight, portable text editor for POSIX systems.
+ *
+ * Copyright (C) 2021, Eric Londo <londoed@comcast.net>, { keyword.h }.
+ * This software is distributed under the GNU General Public License Version 2.0.
+ * Refer to the file LICENSE for additional details.
+**/
+
+#ifndef KEYWORD_H
+#define KEYWORD_H
+
+#define KEYWORD_NONE 0
+#define KEYWORD_1 1
+#define KEYWORD_2 2
+
+struct KeywordSlot {
+	const char *word;
+	unsigned char len;
+	unsigned char type;
+};
+
+/**
+ * A keyword list compiled into a perfect hash: the seed is picked so no
+ * two keywords share a slot, so a lookup is one hash and one compare.
+ * Words ending in '_' are stored without it as KEYWORD_2.
+**/
+struct Keywords {
+	struct KeywordSlot *slot;
+	unsigned int mask;
+	unsigned int seed;
+	int max_len;
+};
+
+int keyword_compile(struct Keywords *, char **);
+int keyword_find(const struct Keywords *, const char *, int);
+void keyword_free(struct Keywords *);
+
+#endif
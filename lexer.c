@@ -0,0 +1,317 @@
+/**
+ * ERU: A simple, lightweight, portable text editor for POSIX systems.
+ *
+ * Copyright (C) 2021, Eric Londo <londoed@comcast.net>, { lexer.c }.
+ * This software is distributed under the GNU General Public License Version 2.0.
+ * Refer to the file LICENSE for additional details.
+**/
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lexer.h"
+
+enum lex_mode {
+	LEX_MODE_SEP,
+	LEX_MODE_WORD,
+	LEX_MODE_NUM,
+	LEX_MODE_STR,
+	LEX_MODE_ESC,
+	LEX_MODE_MLC,
+	LEX_MODE_LINE,
+};
+
+/**
+ * A state while compiling: the mode, the open quote for strings, and the
+ * tail of the input that could still grow into a comment delimiter.
+**/
+struct LexState {
+	int mode;
+	int quote;
+	int plen;
+	char partial[LEX_DELIM_MAX];
+};
+
+struct LexDef {
+	const char *delim[3];
+	int len[3];
+	int flags;
+};
+
+#define DELIM_SCS 0
+#define DELIM_MCS 1
+#define DELIM_MCE 2
+
+static int
+lexer_is_sep(int c)
+{
+	return isspace(c) || c == '\0' || strchr(LEX_SEPARATORS, c) != NULL;
+}
+
+static int
+lexer_ends_with(const char *s, int n, const char *d, int len)
+{
+	return len > 0 && n >= len && !memcmp(&s[n - len], d, len);
+}
+
+/**
+ * Keep the longest tail of s that is a proper prefix of one of the
+ * delimiters that can start in this mode.
+**/
+static void
+lexer_partial(const struct LexDef *def, const int *which, int n_which, const char *s, int n,
+	struct LexState *to)
+{
+	int k, j;
+
+	for (k = (n < LEX_DELIM_MAX) ? n : LEX_DELIM_MAX - 1; k > 0; k--) {
+		for (j = 0; j < n_which; j++) {
+			int d = which[j];
+
+			if (k < def->len[d] && !memcmp(&s[n - k], def->delim[d], k)) {
+				memcpy(to->partial, &s[n - k], k);
+				to->plen = k;
+
+				return;
+			}
+		}
+	}
+
+	to->plen = 0;
+}
+
+/**
+ * The rules the old hand-written highlighter applied at each position, in
+ * the same order: comment delimiters, strings, numbers, then words.
+**/
+static void
+lexer_step(const struct LexDef *def, const struct LexState *st, int b, struct LexState *to,
+	struct LexTrans *t)
+{
+	char s[LEX_DELIM_MAX + 1];
+	int n = st->plen + 1;
+	int ml = def->len[DELIM_MCS] && def->len[DELIM_MCE];
+
+	memcpy(s, st->partial, st->plen);
+	s[st->plen] = b;
+
+	memset(to, 0, sizeof(struct LexState));
+	t->back = 0;
+	t->kw = 0;
+
+	switch (st->mode) {
+	case LEX_MODE_LINE:
+		to->mode = LEX_MODE_LINE;
+		t->hl = HIGHLIGHT_COMMENT;
+		return;
+
+	case LEX_MODE_ESC:
+		to->mode = LEX_MODE_STR;
+		to->quote = st->quote;
+		t->hl = HIGHLIGHT_STRING;
+		return;
+
+	case LEX_MODE_STR:
+		to->mode = (b == '\\') ? LEX_MODE_ESC : (b == st->quote) ? LEX_MODE_SEP : LEX_MODE_STR;
+		to->quote = (to->mode == LEX_MODE_SEP) ? 0 : st->quote;
+		t->hl = HIGHLIGHT_STRING;
+		return;
+
+	case LEX_MODE_MLC:
+		t->hl = HIGHLIGHT_ML_COMMENT;
+
+		if (lexer_ends_with(s, n, def->delim[DELIM_MCE], def->len[DELIM_MCE])) {
+			to->mode = LEX_MODE_SEP;
+			t->back = def->len[DELIM_MCE];
+		} else {
+			int which[] = { DELIM_MCE };
+
+			to->mode = LEX_MODE_MLC;
+			lexer_partial(def, which, 1, s, n, to);
+		}
+
+		return;
+	}
+
+	if (lexer_ends_with(s, n, def->delim[DELIM_SCS], def->len[DELIM_SCS])) {
+		to->mode = LEX_MODE_LINE;
+		t->hl = HIGHLIGHT_COMMENT;
+		t->back = def->len[DELIM_SCS];
+		return;
+	}
+
+	if (ml && lexer_ends_with(s, n, def->delim[DELIM_MCS], def->len[DELIM_MCS])) {
+		to->mode = LEX_MODE_MLC;
+		t->hl = HIGHLIGHT_ML_COMMENT;
+		t->back = def->len[DELIM_MCS];
+		return;
+	}
+
+	int which[] = { DELIM_SCS, DELIM_MCS };
+
+	lexer_partial(def, which, ml ? 2 : 1, s, n, to);
+
+	if ((def->flags & HIGHLIGHT_STRINGS) && (b == '"' || b == '\'')) {
+		to->mode = LEX_MODE_STR;
+		to->quote = b;
+		to->plen = 0;
+		t->hl = HIGHLIGHT_STRING;
+		return;
+	}
+
+	if ((def->flags & HIGHLIGHT_NUMBERS) && ((isdigit(b) && st->mode != LEX_MODE_WORD) ||
+		(b == '.' && st->mode == LEX_MODE_NUM))) {
+
+		to->mode = LEX_MODE_NUM;
+		t->hl = HIGHLIGHT_NUMBER;
+		return;
+	}
+
+	to->mode = lexer_is_sep(b) ? LEX_MODE_SEP : LEX_MODE_WORD;
+	t->hl = HIGHLIGHT_NORMAL;
+	t->kw = (st->mode == LEX_MODE_SEP && to->mode == LEX_MODE_WORD);
+}
+
+static int
+lexer_state_id(struct LexState *states, int *n, const struct LexState *st)
+{
+	int i;
+
+	for (i = 0; i < *n; i++) {
+		if (states[i].mode == st->mode && states[i].quote == st->quote &&
+			states[i].plen == st->plen && !memcmp(states[i].partial, st->partial, st->plen))
+			return i;
+	}
+
+	if (*n == LEX_STATES_MAX)
+		return -1;
+
+	states[*n] = *st;
+
+	return (*n)++;
+}
+
+/**
+ * Give every byte a class. Bytes named by a rule get one of their own;
+ * the rest only differ in being separators or digits.
+**/
+static void
+lexer_classes(struct Lexer *lex, const struct LexDef *def)
+{
+	int key_cls[256 + 4];
+	int b, d;
+
+	memset(key_cls, -1, sizeof(key_cls));
+	lex->num_cls = 0;
+
+	for (b = 0; b < 256; b++) {
+		int special = (b == '"' || b == '\'' || b == '\\' || b == '.');
+
+		for (d = 0; d < 3 && !special; d++)
+			special = (def->len[d] && memchr(def->delim[d], b, def->len[d]) != NULL);
+
+		int key = special ? b : 256 + lexer_is_sep(b) * 2 + (isdigit(b) != 0);
+
+		if (key_cls[key] == -1)
+			key_cls[key] = lex->num_cls++;
+
+		lex->cls[b] = key_cls[key];
+		lex->sep[b] = lexer_is_sep(b);
+	}
+}
+
+/**
+ * Compile a syntax definition. Delimiters may be at most LEX_DELIM_MAX - 1
+ * bytes. Returns NULL if it can't be built.
+**/
+struct Lexer *
+lexer_compile(const char *scs, const char *mcs, const char *mce, char **keywords, int flags)
+{
+	struct LexDef def = { { scs, mcs, mce }, { 0, 0, 0 }, flags };
+	struct LexState *states = malloc(sizeof(struct LexState) * LEX_STATES_MAX);
+	struct Lexer *lex = calloc(1, sizeof(struct Lexer));
+	unsigned char rep[256];
+	int i, c, d;
+
+	if (states == NULL || lex == NULL)
+		goto fail;
+
+	for (d = 0; d < 3; d++) {
+		def.len[d] = def.delim[d] ? strlen(def.delim[d]) : 0;
+
+		if (def.len[d] >= LEX_DELIM_MAX)
+			goto fail;
+	}
+
+	lexer_classes(lex, &def);
+
+	for (i = 255; i >= 0; i--)
+		rep[lex->cls[i]] = i;
+
+	struct LexState init[] = {
+		{ LEX_MODE_SEP, 0, 0, { 0 } },
+		{ LEX_MODE_MLC, 0, 0, { 0 } },
+		{ LEX_MODE_WORD, 0, 0, { 0 } },
+		{ LEX_MODE_LINE, 0, 0, { 0 } },
+	};
+	int n = 0;
+
+	for (i = 0; i < 4; i++)
+		lexer_state_id(states, &n, &init[i]);
+
+	lex->start[LEX_NORMAL] = 0;
+	lex->start[LEX_ML_COMMENT] = 1;
+	lex->word = 2;
+	lex->line = 3;
+
+	for (i = 0; i < n; i++) {
+		struct LexTrans *row = realloc(lex->trans, sizeof(struct LexTrans) * (i + 1) * lex->num_cls);
+
+		if (row == NULL)
+			goto fail;
+
+		lex->trans = row;
+		row = &lex->trans[i * lex->num_cls];
+
+		for (c = 0; c < lex->num_cls; c++) {
+			struct LexState to;
+			int id;
+
+			lexer_step(&def, &states[i], rep[c], &to, &row[c]);
+
+			if ((id = lexer_state_id(states, &n, &to)) == -1)
+				goto fail;
+
+			row[c].next = id;
+		}
+
+		lex->out[i] = (states[i].mode == LEX_MODE_MLC) ? LEX_ML_COMMENT : LEX_NORMAL;
+	}
+
+	lex->num_states = n;
+
+	if (keyword_compile(&lex->kw, keywords) == -1)
+		goto fail;
+
+	free(states);
+
+	return lex;
+
+fail:
+	free(states);
+	lexer_free(lex);
+
+	return NULL;
+}
+
+void
+lexer_free(struct Lexer *lex)
+{
+	if (lex == NULL)
+		return;
+
+	keyword_free(&lex->kw);
+	free(lex->trans);
+	free(lex);
+}
@@ -0,0 +1,72 @@
+/**
+ * ERU: A simple, lightweight, portable text editor for POSIX systems.
+ *
+ * Copyright (C) 2021, Eric Londo <londoed@comcast.net>, { lexer.h }.
+ * This software is distributed under the GNU General Public License Version 2.0.
+ * Refer to the file LICENSE for additional details.
+**/
+
+#ifndef LEXER_H
+#define LEXER_H
+
+#include "keyword.h"
+
+#define HIGHLIGHT_NUMBERS (1 << 0)
+#define HIGHLIGHT_STRINGS (1 << 1)
+#define LEX_SEPARATORS ",.()+-/*=~%<>[];"
+#define LEX_DELIM_MAX 8
+#define LEX_STATES_MAX 255
+
+enum eru_highlight {
+	HIGHLIGHT_NORMAL = 0,
+	HIGHLIGHT_COMMENT,
+	HIGHLIGHT_ML_COMMENT,
+	HIGHLIGHT_STRING,
+	HIGHLIGHT_NUMBER,
+	HIGHLIGHT_MATCH,
+	HIGHLIGHT_KEYW1,
+	HIGHLIGHT_KEYW2,
+};
+
+/**
+ * What a row hands to the next one: all lexer states fold into these at
+ * a line break.
+**/
+enum eru_lex_state {
+	LEX_NORMAL = 0,
+	LEX_ML_COMMENT,
+};
+
+/**
+ * One DFA edge: the state to go to, the highlight of the byte, and, when
+ * the byte completes a comment delimiter, how many bytes back (this one
+ * included) get that highlight. kw is set where a keyword may start.
+**/
+struct LexTrans {
+	unsigned char next;
+	unsigned char hl;
+	unsigned char back;
+	unsigned char kw;
+};
+
+/**
+ * A syntax definition compiled into a byte-class DFA. Bytes that act
+ * alike in every state share a class, so trans is num_states rows of
+ * num_cls edges. start maps an eru_lex_state to the state a row begins
+ * in and out maps each state back at the end of a row.
+**/
+struct Lexer {
+	unsigned char cls[256];
+	unsigned char sep[256];
+	int num_cls, num_states;
+	int line, word;
+	unsigned char start[2];
+	unsigned char out[LEX_STATES_MAX];
+	struct LexTrans *trans;
+	struct Keywords kw;
+};
+
+struct Lexer *lexer_compile(const char *, const char *, const char *, char **, int);
+void lexer_free(struct Lexer *);
+
+#endif
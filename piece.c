@@ -0,0 +1,523 @@
+/**
+ * ERU: A simple, lightweight, portable text editor for POSIX systems.
+ *
+ * Copyright (C) 2021, Eric Londo <londoed@comcast.net>, { piece.c }.
+ * This software is distributed under the GNU General Public License Version 2.0.
+ * Refer to the file LICENSE for additional details.
+**/
+
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "piece.h"
+
+/**
+ * Rows and their gap buffers come out of the editor's arena.
+**/
+void
+piece_init(struct PieceTable *pt, struct Arena *arena)
+{
+	pt->arena = arena;
+	pt->orig = NULL;
+	pt->orig_len = 0;
+	pt->orig_mapped = 0;
+	pt->add = NULL;
+	pt->root = NULL;
+	pt->num_lines = 0;
+}
+
+static void
+piece_free_node(RowNode *node)
+{
+	int i;
+
+	for (i = 0; !node->is_leaf && i < node->count; i++)
+		piece_free_node(node->slot[i]);
+
+	free(node);
+}
+
+/**
+ * Free the tree and the text buffers. The rows themselves live in the
+ * arena and are released in bulk along with it.
+**/
+void
+piece_free(struct PieceTable *pt)
+{
+	if (pt->root)
+		piece_free_node(pt->root);
+
+	while (pt->add) {
+		struct AddBlock *next = pt->add->next;
+
+		free(pt->add);
+		pt->add = next;
+	}
+
+	piece_set_orig(pt, NULL, 0, 0);
+	piece_init(pt, pt->arena);
+}
+
+/**
+ * Hand the table the file contents, either a malloc'd buffer or a
+ * read-only mapping. It is owned from here on and never written.
+**/
+void
+piece_set_orig(struct PieceTable *pt, char *buf, size_t len, int mapped)
+{
+	if (pt->orig_mapped)
+		munmap(pt->orig, pt->orig_len);
+	else
+		free(pt->orig);
+
+	pt->orig = buf;
+	pt->orig_len = len;
+	pt->orig_mapped = mapped;
+}
+
+/**
+ * Claim len bytes at the end of the add buffer. Blocks are never moved, so
+ * the returned pointer stays valid for the life of the table.
+**/
+char *
+piece_reserve(struct PieceTable *pt, size_t len)
+{
+	struct AddBlock *b = pt->add;
+
+	if (b == NULL || b->cap - b->len < len) {
+		size_t cap = (len > PIECE_ADD_BLOCK) ? len : PIECE_ADD_BLOCK;
+
+		b = malloc(sizeof(struct AddBlock) + cap);
+
+		if (b == NULL)
+			return NULL;
+
+		b->len = 0;
+		b->cap = cap;
+		b->next = pt->add;
+		pt->add = b;
+	}
+
+	b->len += len;
+
+	return &b->data[b->len - len];
+}
+
+static RowNode *
+piece_new_node(int is_leaf)
+{
+	RowNode *node = calloc(1, sizeof(RowNode));
+
+	if (node)
+		node->is_leaf = is_leaf;
+
+	return node;
+}
+
+static int
+piece_slot(const RowNode *node, const void *p)
+{
+	int i;
+
+	for (i = 0; i < node->count; i++) {
+		if (node->slot[i] == p)
+			break;
+	}
+
+	return i;
+}
+
+/**
+ * Descend to the leaf holding line *at, leaving the slot within it in *at.
+ * An *at equal to the line count lands one past the last row.
+**/
+static RowNode *
+piece_find(RowNode *node, int *at)
+{
+	while (!node->is_leaf) {
+		int i;
+
+		for (i = 0; i < node->count - 1; i++) {
+			RowNode *child = node->slot[i];
+
+			if (*at < child->lines)
+				break;
+
+			*at -= child->lines;
+		}
+
+		node = node->slot[i];
+	}
+
+	return node;
+}
+
+static void
+piece_adjust(RowNode *node, int delta)
+{
+	for (; node; node = node->parent)
+		node->lines += delta;
+}
+
+/**
+ * Move the upper half of a full node into a new right sibling, splitting
+ * the parent first if it has no room for it.
+**/
+static int
+piece_split(struct PieceTable *pt, RowNode *node)
+{
+	RowNode *parent = node->parent;
+	int half = PIECE_NODE_MAX / 2;
+	int i;
+
+	if (parent == NULL) {
+		if ((parent = piece_new_node(0)) == NULL)
+			return -1;
+
+		parent->slot[0] = node;
+		parent->count = 1;
+		parent->lines = node->lines;
+		node->parent = parent;
+		pt->root = parent;
+	} else if (parent->count == PIECE_NODE_MAX) {
+		if (piece_split(pt, parent) == -1)
+			return -1;
+
+		parent = node->parent;
+	}
+
+	RowNode *sib = piece_new_node(node->is_leaf);
+
+	if (sib == NULL)
+		return -1;
+
+	memcpy(sib->slot, &node->slot[half], sizeof(void *) * (PIECE_NODE_MAX - half));
+	sib->count = PIECE_NODE_MAX - half;
+	node->count = half;
+
+	for (i = 0; i < sib->count; i++) {
+		if (sib->is_leaf) {
+			((Row *)sib->slot[i])->leaf = sib;
+			sib->lines++;
+		} else {
+			((RowNode *)sib->slot[i])->parent = sib;
+			sib->lines += ((RowNode *)sib->slot[i])->lines;
+		}
+	}
+
+	node->lines -= sib->lines;
+
+	int pos = piece_slot(parent, node) + 1;
+
+	memmove(&parent->slot[pos + 1], &parent->slot[pos], sizeof(void *) * (parent->count - pos));
+	parent->slot[pos] = sib;
+	parent->count++;
+	sib->parent = parent;
+
+	return 0;
+}
+
+Row *
+piece_row(struct PieceTable *pt, int at)
+{
+	if (at < 0 || at >= pt->num_lines)
+		return NULL;
+
+	RowNode *leaf = piece_find(pt->root, &at);
+
+	return leaf->slot[at];
+}
+
+/**
+ * The rows from line at to the end of its leaf, in order, with their
+ * number in *n. Walking a long stretch of rows this way costs one lookup
+ * per leaf instead of one per row.
+**/
+void *const *
+piece_rows(struct PieceTable *pt, int at, int *n)
+{
+	if (at < 0 || at >= pt->num_lines) {
+		*n = 0;
+		return NULL;
+	}
+
+	RowNode *leaf = piece_find(pt->root, &at);
+
+	*n = leaf->count - at;
+
+	return &leaf->slot[at];
+}
+
+int
+piece_row_index(const Row *row)
+{
+	const RowNode *node = row->leaf;
+	int idx = piece_slot(node, row);
+
+	for (; node->parent; node = node->parent) {
+		const RowNode *parent = node->parent;
+		int i, pos = piece_slot(parent, node);
+
+		for (i = 0; i < pos; i++)
+			idx += ((RowNode *)parent->slot[i])->lines;
+	}
+
+	return idx;
+}
+
+Row *
+piece_row_prev(const Row *row)
+{
+	const RowNode *node = row->leaf;
+	int pos = piece_slot(node, row);
+
+	if (pos > 0)
+		return node->slot[pos - 1];
+
+	for (; node->parent; node = node->parent) {
+		pos = piece_slot(node->parent, node);
+
+		if (pos > 0) {
+			node = node->parent->slot[pos - 1];
+
+			while (!node->is_leaf)
+				node = node->slot[node->count - 1];
+
+			return node->slot[node->count - 1];
+		}
+	}
+
+	return NULL;
+}
+
+Row *
+piece_row_next(const Row *row)
+{
+	const RowNode *node = row->leaf;
+	int pos = piece_slot(node, row);
+
+	if (pos + 1 < node->count)
+		return node->slot[pos + 1];
+
+	for (; node->parent; node = node->parent) {
+		pos = piece_slot(node->parent, node);
+
+		if (pos + 1 < node->parent->count) {
+			node = node->parent->slot[pos + 1];
+
+			while (!node->is_leaf)
+				node = node->slot[0];
+
+			return node->slot[0];
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Insert a row viewing size bytes of chars at line at. The chars must live
+ * in the original buffer, the add buffer, or static storage.
+**/
+Row *
+piece_insert(struct PieceTable *pt, int at, char *chars, int size)
+{
+	if (at < 0 || at > pt->num_lines)
+		return NULL;
+
+	if (pt->root == NULL && (pt->root = piece_new_node(1)) == NULL)
+		return NULL;
+
+	int pos = at;
+	RowNode *leaf = piece_find(pt->root, &pos);
+
+	if (leaf->count == PIECE_NODE_MAX) {
+		if (piece_split(pt, leaf) == -1)
+			return NULL;
+
+		pos = at;
+		leaf = piece_find(pt->root, &pos);
+	}
+
+	Row *row = arena_alloc_sized(pt->arena, sizeof(Row));
+
+	if (row == NULL)
+		return NULL;
+
+	memset(row, 0, sizeof(Row));
+	memmove(&leaf->slot[pos + 1], &leaf->slot[pos], sizeof(void *) * (leaf->count - pos));
+	leaf->slot[pos] = row;
+	leaf->count++;
+	piece_adjust(leaf, 1);
+
+	row->chars = chars;
+	row->size = size;
+	row->leaf = leaf;
+	pt->num_lines++;
+
+	return row;
+}
+
+/**
+ * Drop the row at line at. Its render buffers must already be released.
+ * Emptied nodes are unlinked and a root with one child is collapsed.
+**/
+void
+piece_delete(struct PieceTable *pt, int at)
+{
+	if (at < 0 || at >= pt->num_lines)
+		return;
+
+	RowNode *node = piece_find(pt->root, &at);
+	Row *row = node->slot[at];
+
+	if (row->cap)
+		arena_free(pt->arena, row->chars);
+
+	arena_free_sized(pt->arena, row, sizeof(Row));
+	memmove(&node->slot[at], &node->slot[at + 1], sizeof(void *) * (node->count - at - 1));
+	node->count--;
+	piece_adjust(node, -1);
+	pt->num_lines--;
+
+	while (node->count == 0 && node->parent) {
+		RowNode *parent = node->parent;
+		int pos = piece_slot(parent, node);
+
+		memmove(&parent->slot[pos], &parent->slot[pos + 1], sizeof(void *) * (parent->count - pos - 1));
+		parent->count--;
+		free(node);
+		node = parent;
+	}
+
+	while (!pt->root->is_leaf && pt->root->count == 1) {
+		RowNode *root = pt->root;
+
+		pt->root = root->slot[0];
+		pt->root->parent = NULL;
+		free(root);
+	}
+}
+
+/**
+ * Render checkpoints up to the edited column stay good. Highlight ones
+ * keep a stride of slack, since the lexer looks ahead of its position.
+**/
+static void
+piece_row_cut_ckpt(Row *row, int at)
+{
+	if (row->num_ckpt > at / ROW_CKPT + 1)
+		row->num_ckpt = at / ROW_CKPT + 1;
+
+	if (row->num_lex > at / ROW_CKPT)
+		row->num_lex = at / ROW_CKPT;
+}
+
+static void
+piece_row_move_gap(Row *row, int at)
+{
+	if (at < row->gap_start)
+		memmove(&row->chars[at + row->gap_len], &row->chars[at], row->gap_start - at);
+	else if (at > row->gap_start)
+		memmove(&row->chars[row->gap_start], &row->chars[row->gap_start + row->gap_len], at - row->gap_start);
+
+	row->gap_start = at;
+}
+
+/**
+ * Make sure the row owns a gap buffer with at least need bytes of gap,
+ * copying it out of the table on first edit and doubling it after that.
+**/
+static int
+piece_row_reserve(struct PieceTable *pt, Row *row, int need)
+{
+	if (row->cap && row->gap_len >= need)
+		return 0;
+
+	int cap = (row->cap ? row->cap : row->size) * 2;
+
+	if (cap < row->size + need)
+		cap = row->size + need;
+
+	if (cap < 16)
+		cap = 16;
+
+	if (row->cap == 0) {
+		char *buf = arena_alloc(pt->arena, cap);
+
+		if (buf == NULL)
+			return -1;
+
+		memcpy(buf, row->chars, row->size);
+		row->chars = buf;
+		row->gap_start = row->size;
+	} else {
+		char *buf = arena_realloc(pt->arena, row->chars, cap);
+		int tail = row->size - row->gap_start;
+
+		if (buf == NULL)
+			return -1;
+
+		memmove(&buf[cap - tail], &buf[row->gap_start + row->gap_len], tail);
+		row->chars = buf;
+	}
+
+	row->gap_len = cap - row->size;
+	row->cap = cap;
+
+	return 0;
+}
+
+int
+piece_row_insert(struct PieceTable *pt, Row *row, int at, const char *s, int len)
+{
+	if (piece_row_reserve(pt, row, len) == -1)
+		return -1;
+
+	piece_row_cut_ckpt(row, at);
+	piece_row_move_gap(row, at);
+	memcpy(&row->chars[row->gap_start], s, len);
+	row->gap_start += len;
+	row->gap_len -= len;
+	row->size += len;
+
+	return 0;
+}
+
+int
+piece_row_delete(struct PieceTable *pt, Row *row, int at, int len)
+{
+	if (at + len > row->size)
+		len = row->size - at;
+
+	piece_row_cut_ckpt(row, at);
+
+	if (row->cap == 0 && at + len == row->size) {
+		row->size = at;
+		return 0;
+	}
+
+	if (piece_row_reserve(pt, row, 0) == -1)
+		return -1;
+
+	piece_row_move_gap(row, at);
+	row->gap_len += len;
+	row->size -= len;
+
+	return 0;
+}
+
+/**
+ * Close the gap at the end of the row so chars holds size contiguous bytes.
+**/
+char *
+piece_row_chars(Row *row)
+{
+	if (row->cap)
+		piece_row_move_gap(row, row->size);
+
+	return row->chars;
+}
@@ -0,0 +1,120 @@
+/**
+ * ERU: A simple, lightweight, portable text editor for POSIX systems.
+ *
+ * Copyright (C) 2021, Eric Londo <londoed@comcast.net>, { piece.h }.
+ * This software is distributed under the GNU General Public License Version 2.0.
+ * Refer to the file LICENSE for additional details.
+**/
+
+#ifndef PIECE_H
+#define PIECE_H
+
+#include <stddef.h>
+
+#include "arena.h"
+
+#define PIECE_NODE_MAX 64
+#define PIECE_ADD_BLOCK (64 * 1024)
+#define ROW_CKPT 256
+
+#define ROW_CHAR(row, i) ((row)->chars[(i) < (row)->gap_start ? (i) : (i) + (row)->gap_len])
+
+/**
+ * rx is the render column of char k * ROW_CKPT; pos and state are where
+ * the highlighter was, and in which lexer state, when it first reached rx
+ * or went past it.
+**/
+struct RowCkpt {
+	int rx;
+	int pos;
+	unsigned char state;
+};
+
+/**
+ * A row is a piece: its chars view a line of either the read-only original
+ * buffer or the append-only add buffer, and are never written through.
+ * They are not NUL-terminated; size is authoritative.
+ *
+ * The first edit gives the row its own gap buffer (cap > 0) whose gap
+ * follows the cursor. Read single bytes with ROW_CHAR, and call
+ * piece_row_chars() before treating chars as contiguous.
+ *
+ * Rows of ROW_CKPT chars or more keep a checkpoint per ROW_CKPT chars
+ * so render and highlight can be rebuilt from an edit onward. An edit
+ * cuts num_ckpt and num_lex back to the edited column.
+**/
+/**
+ * Render columns up to end that share one highlight; a run starts where
+ * the one before it ends. A row's runs cover its whole render and no run
+ * has the same class as the one before it. Packed into one word, so even
+ * a row that changes class every few columns costs less than a byte per
+ * column. end can't go past HL_RUN_MAX; columns beyond it all fall in
+ * the last run.
+**/
+#define HL_RUN_MAX ((1 << 28) - 1)
+
+struct HlRun {
+	unsigned int end : 28;
+	unsigned int hl : 4;
+};
+
+typedef struct Row {
+	int size, rsize;
+	unsigned char hl_in, hl_out;
+	int flags;
+	int gap_start, gap_len, cap;
+	char *chars;
+	char *render;
+	struct HlRun *hl;
+	int num_hl, hl_cap;
+	struct RowCkpt *ckpt;
+	int num_ckpt, num_lex, ckpt_cap;
+	struct RowNode *leaf;
+} Row;
+
+/**
+ * B+tree node keyed by line count. Leaves hold Row pointers, interior
+ * nodes hold children; lines is the number of rows below the node.
+**/
+typedef struct RowNode {
+	struct RowNode *parent;
+	int is_leaf;
+	int count;
+	int lines;
+	void *slot[PIECE_NODE_MAX];
+} RowNode;
+
+struct AddBlock {
+	struct AddBlock *next;
+	size_t len, cap;
+	char data[];
+};
+
+struct PieceTable {
+	struct Arena *arena;
+	char *orig;
+	size_t orig_len;
+	int orig_mapped;
+	struct AddBlock *add;
+	RowNode *root;
+	int num_lines;
+};
+
+void piece_init(struct PieceTable *, struct Arena *);
+void piece_free(struct PieceTable *);
+void piece_set_orig(struct PieceTable *, char *, size_t, int);
+char *piece_reserve(struct PieceTable *, size_t);
+
+Row *piece_row(struct PieceTable *, int);
+void *const *piece_rows(struct PieceTable *, int, int *);
+int piece_row_index(const Row *);
+Row *piece_row_prev(const Row *);
+Row *piece_row_next(const Row *);
+Row *piece_insert(struct PieceTable *, int, char *, int);
+void piece_delete(struct PieceTable *, int);
+
+int piece_row_insert(struct PieceTable *, Row *, int, const char *, int);
+int piece_row_delete(struct PieceTable *, Row *, int, int);
+char *piece_row_chars(Row *);
+
+#endif
@@ -9,12 +9,8 @@
 #ifndef POINT_H
 #define POINT_H
 
-#include "eru.h"
-
 typedef struct Point {
 	int y, x;
 } Point;
 
-Point point_w(Editor);
-
 #endif
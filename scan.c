@@ -0,0 +1,228 @@
+/**
+ * ERU: A simple, lightweight, portable text editor for POSIX systems.
+ *
+ * Copyright (C) 2021, Eric Londo <londoed@comcast.net>, { scan.c }.
+ * This software is distributed under the GNU General Public License Version 2.0.
+ * Refer to the file LICENSE for additional details.
+**/
+
+#define _DEFAULT_SOURCE
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+#include "scan.h"
+
+struct ScanJob {
+	const char *buf;
+	size_t from, to;
+	struct LineIndex idx;
+	int err;
+};
+
+static int
+scan_push(struct LineIndex *idx, size_t off)
+{
+	if (idx->count == idx->cap) {
+		size_t cap = idx->cap ? idx->cap * 2 : 4096;
+		size_t *start = realloc(idx->start, sizeof(size_t) * cap);
+
+		if (start == NULL)
+			return -1;
+
+		idx->start = start;
+		idx->cap = cap;
+	}
+
+	idx->start[idx->count++] = off;
+
+	return 0;
+}
+
+static int
+scan_scalar(const char *buf, size_t from, size_t to, struct LineIndex *idx)
+{
+	const char *p = buf + from;
+	const char *end = buf + to;
+
+	while (p < end && (p = memchr(p, '\n', end - p)) != NULL) {
+		if (scan_push(idx, p - buf + 1) == -1)
+			return -1;
+
+		p++;
+	}
+
+	return 0;
+}
+
+#ifdef SCAN_X86
+/**
+ * Compare a whole vector against '\n' at once and walk the set bits of
+ * the resulting mask, so short lines cost no per-line call.
+**/
+static int
+scan_sse2(const char *buf, size_t from, size_t to, struct LineIndex *idx)
+{
+	const __m128i nl = _mm_set1_epi8('\n');
+	size_t i;
+
+	for (i = from; i + 16 <= to; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+		unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+
+		while (mask) {
+			if (scan_push(idx, i + __builtin_ctz(mask) + 1) == -1)
+				return -1;
+
+			mask &= mask - 1;
+		}
+	}
+
+	return scan_scalar(buf, i, to, idx);
+}
+
+__attribute__((target("avx2")))
+static int
+scan_avx2(const char *buf, size_t from, size_t to, struct LineIndex *idx)
+{
+	const __m256i nl = _mm256_set1_epi8('\n');
+	size_t i;
+
+	for (i = from; i + 32 <= to; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
+		unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+
+		while (mask) {
+			if (scan_push(idx, i + __builtin_ctz(mask) + 1) == -1)
+				return -1;
+
+			mask &= mask - 1;
+		}
+	}
+
+	return scan_sse2(buf, i, to, idx);
+}
+#endif
+
+static int
+scan_range(const char *buf, size_t from, size_t to, struct LineIndex *idx)
+{
+#ifdef SCAN_X86
+	if (__builtin_cpu_supports("avx2"))
+		return scan_avx2(buf, from, to, idx);
+
+	return scan_sse2(buf, from, to, idx);
+#else
+	return scan_scalar(buf, from, to, idx);
+#endif
+}
+
+static void *
+scan_worker(void *arg)
+{
+	struct ScanJob *job = arg;
+
+	job->err = scan_range(job->buf, job->from, job->to, &job->idx);
+
+	return NULL;
+}
+
+/**
+ * Index the line starts of buf. Buffers of SCAN_PARALLEL_MIN bytes or more
+ * are cut into one chunk per CPU, each scanned on its own thread, and the
+ * per-chunk offsets are concatenated in order afterwards.
+**/
+int
+scan_lines(const char *buf, size_t len, struct LineIndex *idx)
+{
+	struct ScanJob jobs[SCAN_MAX_THREADS];
+	pthread_t tids[SCAN_MAX_THREADS];
+	int started[SCAN_MAX_THREADS];
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	int n = 1, i, err = 0;
+
+	memset(idx, 0, sizeof(struct LineIndex));
+
+	if (len == 0)
+		return 0;
+
+	if (len >= SCAN_PARALLEL_MIN && ncpu > 1)
+		n = (ncpu > SCAN_MAX_THREADS) ? SCAN_MAX_THREADS : ncpu;
+
+	for (i = 0; i < n; i++) {
+		memset(&jobs[i], 0, sizeof(struct ScanJob));
+		jobs[i].buf = buf;
+		jobs[i].from = len / n * i;
+		jobs[i].to = (i == n - 1) ? len : len / n * (i + 1);
+		started[i] = 0;
+	}
+
+	if (scan_push(&jobs[0].idx, 0) == -1)
+		return -1;
+
+	for (i = 1; i < n; i++) {
+		if (pthread_create(&tids[i], NULL, scan_worker, &jobs[i]) == 0)
+			started[i] = 1;
+		else
+			scan_worker(&jobs[i]);
+	}
+
+	scan_worker(&jobs[0]);
+
+	for (i = 1; i < n; i++) {
+		if (started[i])
+			pthread_join(tids[i], NULL);
+	}
+
+	if (n == 1) {
+		*idx = jobs[0].idx;
+		err = jobs[0].err;
+	} else {
+		size_t total = 0;
+
+		for (i = 0; i < n; i++) {
+			total += jobs[i].idx.count;
+			err |= jobs[i].err;
+		}
+
+		if (!err && (idx->start = malloc(sizeof(size_t) * (total + 1))) != NULL) {
+			idx->cap = total + 1;
+
+			for (i = 0; i < n; i++) {
+				memcpy(&idx->start[idx->count], jobs[i].idx.start, sizeof(size_t) * jobs[i].idx.count);
+				idx->count += jobs[i].idx.count;
+			}
+		} else {
+			err = -1;
+		}
+
+		for (i = 0; i < n; i++)
+			free(jobs[i].idx.start);
+	}
+
+	if (!err && buf[len - 1] != '\n')
+		err = scan_push(idx, len + 1);
+
+	if (err) {
+		scan_free(idx);
+		return -1;
+	}
+
+	idx->count--;
+
+	return 0;
+}
+
+void
+scan_free(struct LineIndex *idx)
+{
+	free(idx->start);
+	memset(idx, 0, sizeof(struct LineIndex));
+}
@@ -0,0 +1,30 @@
+/**
+ * ERU: A simple, lightweight, portable text editor for POSIX systems.
+ *
+ * Copyright (C) 2021, Eric Londo <londoed@comcast.net>, { scan.h }.
+ * This software is distributed under the GNU General Public License Version 2.0.
+ * Refer to the file LICENSE for additional details.
+**/
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+
+#define SCAN_PARALLEL_MIN (16 * 1024 * 1024)
+#define SCAN_MAX_THREADS 16
+
+/**
+ * Line-offset index of a buffer. Line i starts at start[i] and ends just
+ * before start[i + 1] - 1, which is where its newline sits. A final line
+ * without a newline gets a sentinel of len + 1 so the same rule holds.
+**/
+struct LineIndex {
+	size_t *start;
+	size_t count, cap;
+};
+
+int scan_lines(const char *, size_t, struct LineIndex *);
+void scan_free(struct LineIndex *);
+
+#endif
@@ -0,0 +1,356 @@
+/**
+ * ERU: A simple, lightweight, portable text editor for POSIX systems.
+ *
+ * Copyright (C) 2021, Eric Londo <londoed@comcast.net>, { screen.c }.
+ * This software is distributed under the GNU General Public License Version 2.0.
+ * Refer to the file LICENSE for additional details.
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "screen.h"
+
+/**
+ * Claim len bytes at the end of the buffer for the caller to fill in, or
+ * return NULL if it can't grow.
+**/
+char *
+abuf_reserve(struct AppendBuffer *ab, int len)
+{
+	if (ab->len + len > ab->cap) {
+		int cap = ab->cap ? ab->cap : ABUF_MIN;
+
+		while (cap < ab->len + len)
+			cap *= 2;
+
+		char *new_buf = realloc(ab->buf, cap);
+
+		if (new_buf == NULL)
+			return NULL;
+
+		ab->buf = new_buf;
+		ab->cap = cap;
+	}
+
+	ab->len += len;
+
+	return &ab->buf[ab->len - len];
+}
+
+void
+abuf_append(struct AppendBuffer *ab, const char *s, int len)
+{
+	char *p = abuf_reserve(ab, len);
+
+	if (p)
+		memcpy(p, s, len);
+}
+
+/**
+ * Empty the buffer for the next frame, keeping its memory.
+**/
+void
+abuf_reset(struct AppendBuffer *ab)
+{
+	ab->len = 0;
+}
+
+void
+abuf_free(struct AppendBuffer *ab)
+{
+	free(ab->buf);
+	ab->buf = NULL;
+	ab->len = ab->cap = 0;
+}
+
+static void
+screen_blank(struct Cell *c, int n)
+{
+	while (n--) {
+		c->ch = ' ';
+		c->fg = 0;
+		c->attr = 0;
+		c++;
+	}
+}
+
+static int
+screen_is_blank(const struct Cell *c)
+{
+	return c->ch == ' ' && c->fg == 0 && c->attr == 0;
+}
+
+static int
+screen_same(const struct Cell *a, const struct Cell *b)
+{
+	return a->ch == b->ch && a->fg == b->fg && a->attr == b->attr;
+}
+
+int
+screen_init(struct Screen *s, int rows, int cols)
+{
+	size_t n = (size_t)rows * cols;
+
+	s->rows = rows;
+	s->cols = cols;
+	s->front = malloc(sizeof(struct Cell) * n);
+	s->back = malloc(sizeof(struct Cell) * n);
+	s->touched = malloc(rows);
+
+	if (s->front == NULL || s->back == NULL || s->touched == NULL) {
+		screen_free(s);
+		return -1;
+	}
+
+	screen_blank(s->back, n);
+	screen_invalidate(s);
+	s->can_scroll = 1;
+
+	return 0;
+}
+
+void
+screen_free(struct Screen *s)
+{
+	free(s->front);
+	free(s->back);
+	free(s->touched);
+	s->front = s->back = NULL;
+	s->touched = NULL;
+}
+
+/**
+ * Forget what the terminal shows. The next flush clears it and repaints
+ * every cell of the back grid.
+**/
+void
+screen_invalidate(struct Screen *s)
+{
+	s->synced = 0;
+}
+
+void
+screen_put(struct Screen *s, int y, int x, char ch, int fg, int attr)
+{
+	if (y < 0 || y >= s->rows || x < 0 || x >= s->cols)
+		return;
+
+	struct Cell *c = &s->back[y * s->cols + x];
+
+	c->ch = ch;
+	c->fg = fg;
+	c->attr = attr;
+	s->touched[y] = 1;
+}
+
+/**
+ * Write len bytes of text from column x, clipped to the row. Returns the
+ * number of cells written.
+**/
+int
+screen_puts(struct Screen *s, int y, int x, const char *str, int len, int fg, int attr)
+{
+	int i;
+
+	if (x + len > s->cols)
+		len = s->cols - x;
+
+	for (i = 0; i < len; i++)
+		screen_put(s, y, x + i, str[i], fg, attr);
+
+	return (len > 0) ? len : 0;
+}
+
+/**
+ * Blank row y of the back grid from column x to the right edge.
+**/
+void
+screen_clear_row(struct Screen *s, int y, int x)
+{
+	if (y < 0 || y >= s->rows || x >= s->cols)
+		return;
+
+	if (x < 0)
+		x = 0;
+
+	screen_blank(&s->back[y * s->cols + x], s->cols - x);
+	s->touched[y] = 1;
+}
+
+static void
+screen_move(struct Screen *s, struct AppendBuffer *ab, int y, int x)
+{
+	char buf[32];
+	int len;
+
+	if (s->cur_y == y && s->cur_x == x)
+		return;
+
+	if (s->cur_y == y && s->cur_x != -1)
+		len = snprintf(buf, sizeof(buf), "\x1b[%dG", x + 1);
+	else
+		len = snprintf(buf, sizeof(buf), "\x1b[%d;%dH", y + 1, x + 1);
+
+	abuf_append(ab, buf, len);
+	s->cur_y = y;
+	s->cur_x = x;
+}
+
+/**
+ * Switch the terminal pen to fg and attr with one SGR sequence carrying
+ * only the parameters that change.
+**/
+static void
+screen_pen(struct Screen *s, struct AppendBuffer *ab, int fg, int attr)
+{
+	char buf[32];
+	int len = 2;
+
+	if (s->pen_fg == fg && s->pen_attr == attr)
+		return;
+
+	memcpy(buf, "\x1b[", 2);
+
+	if ((s->pen_attr ^ attr) & SCREEN_INVERSE)
+		len += snprintf(&buf[len], sizeof(buf) - len, "%s", (attr & SCREEN_INVERSE) ? "7" : "27");
+
+	if (s->pen_fg != fg)
+		len += snprintf(&buf[len], sizeof(buf) - len, "%s%d", (len > 2) ? ";" : "", fg ? fg : 39);
+
+	buf[len++] = 'm';
+	abuf_append(ab, buf, len);
+	s->pen_fg = fg;
+	s->pen_attr = attr;
+}
+
+static void
+screen_shift(struct Cell *grid, int cols, int top, int bottom, int n)
+{
+	int rows = bottom - top + 1;
+	int keep = rows - (n < 0 ? -n : n);
+
+	if (n > 0) {
+		memmove(&grid[top * cols], &grid[(top + n) * cols], sizeof(struct Cell) * keep * cols);
+		screen_blank(&grid[(top + keep) * cols], n * cols);
+	} else {
+		memmove(&grid[(top - n) * cols], &grid[top * cols], sizeof(struct Cell) * keep * cols);
+		screen_blank(&grid[top * cols], -n * cols);
+	}
+}
+
+/**
+ * Move rows top to bottom up by n lines, or down for a negative n, using
+ * a DECSTBM scroll region and index or reverse index so the terminal
+ * shifts what it already shows. Both grids shift along with it; the rows
+ * scrolled in are blank and left for the caller to draw. Returns -1 when
+ * the terminal can't do this and the rows must be repainted instead.
+**/
+int
+screen_scroll(struct Screen *s, struct AppendBuffer *ab, int top, int bottom, int n)
+{
+	char buf[32];
+	int len, i;
+
+	if (!s->can_scroll || !s->synced || n == 0 || (n < 0 ? -n : n) > bottom - top)
+		return -1;
+
+	screen_pen(s, ab, s->pen_fg, 0);
+	len = snprintf(buf, sizeof(buf), "\x1b[%d;%dr\x1b[%d;1H", top + 1, bottom + 1,
+		(n > 0 ? bottom : top) + 1);
+	abuf_append(ab, buf, len);
+
+	for (i = 0; i < (n < 0 ? -n : n); i++)
+		abuf_append(ab, (n > 0) ? "\x1b" "D" : "\x1b" "M", 2);
+
+	abuf_append(ab, "\x1b[r", 3);
+	s->cur_y = s->cur_x = -1;
+
+	screen_shift(s->front, s->cols, top, bottom, n);
+	screen_shift(s->back, s->cols, top, bottom, n);
+
+	return 0;
+}
+
+/**
+ * Send the changed spans of each touched row. Unchanged runs shorter than
+ * SCREEN_GAP are rewritten rather than jumped over, since a cursor move
+ * costs about as much, and stale text past the new end of a row is
+ * dropped with a single erase-to-end-of-line.
+**/
+void
+screen_flush(struct Screen *s, struct AppendBuffer *ab)
+{
+	int y;
+
+	if (!s->synced) {
+		abuf_append(ab, "\x1b[m\x1b[H\x1b[2J", 10);
+		screen_blank(s->front, s->rows * s->cols);
+		memset(s->touched, 1, s->rows);
+		s->cur_y = s->cur_x = 0;
+		s->pen_fg = s->pen_attr = 0;
+		s->synced = 1;
+	}
+
+	for (y = 0; y < s->rows; y++) {
+		struct Cell *f = &s->front[y * s->cols];
+		struct Cell *b = &s->back[y * s->cols];
+		int end = s->cols, stale = s->cols;
+		int x = 0;
+
+		if (!s->touched[y])
+			continue;
+
+		s->touched[y] = 0;
+
+		while (end > 0 && screen_is_blank(&b[end - 1]))
+			end--;
+
+		while (stale > end && screen_is_blank(&f[stale - 1]))
+			stale--;
+
+		while (x < end) {
+			if (screen_same(&f[x], &b[x])) {
+				x++;
+				continue;
+			}
+
+			int stop = x + 1, i;
+
+			for (i = x + 1; i < end && i - stop < SCREEN_GAP; i++) {
+				if (!screen_same(&f[i], &b[i]))
+					stop = i + 1;
+			}
+
+			screen_move(s, ab, y, x);
+
+			for (i = x; i < stop; ) {
+				int run = i + 1, k;
+
+				while (run < stop && b[run].fg == b[i].fg && b[run].attr == b[i].attr)
+					run++;
+
+				screen_pen(s, ab, b[i].fg, b[i].attr);
+
+				char *out = abuf_reserve(ab, run - i);
+
+				for (k = i; out && k < run; k++)
+					out[k - i] = b[k].ch;
+
+				memcpy(&f[i], &b[i], sizeof(struct Cell) * (run - i));
+				i = run;
+			}
+
+			s->cur_x = (stop == s->cols) ? -1 : stop;
+			x = stop;
+		}
+
+		if (stale > end) {
+			screen_move(s, ab, y, end);
+			screen_pen(s, ab, s->pen_fg, 0);
+			abuf_append(ab, "\x1b[K", 3);
+			screen_blank(&f[end], s->cols - end);
+		}
+	}
+}
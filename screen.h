@@ -0,0 +1,65 @@
+/**
+ * ERU: A simple, lightweight, portable text editor for POSIX systems.
+ *
+ * Copyright (C) 2021, Eric Londo <londoed@comcast.net>, { screen.h }.
+ * This software is distributed under the GNU General Public License Version 2.0.
+ * Refer to the file LICENSE for additional details.
+**/
+
+#ifndef SCREEN_H
+#define SCREEN_H
+
+#define ABUF_INIT {NULL, 0, 0}
+#define ABUF_MIN 4096
+#define SCREEN_GAP 6
+#define SCREEN_INVERSE (1 << 0)
+
+/**
+ * Output buffer for a frame. It keeps its memory between frames and grows
+ * geometrically, so once it has seen the largest frame it stops allocating.
+**/
+struct AppendBuffer {
+	char *buf;
+	int len, cap;
+};
+
+/**
+ * One screen position. fg is an SGR foreground code, 0 for the terminal
+ * default, and attr holds SCREEN_* flags.
+**/
+struct Cell {
+	char ch;
+	unsigned char fg;
+	unsigned char attr;
+};
+
+/**
+ * Front holds what the terminal is showing, back what the next frame
+ * should show. Drawing only writes the back grid; screen_flush() sends
+ * the cells that differ and brings the front grid up to date.
+**/
+struct Screen {
+	int rows, cols;
+	struct Cell *front, *back;
+	unsigned char *touched;
+	int cur_y, cur_x;
+	unsigned char pen_fg, pen_attr;
+	int synced;
+	int can_scroll;
+};
+
+char *abuf_reserve(struct AppendBuffer *, int);
+void abuf_append(struct AppendBuffer *, const char *, int);
+void abuf_reset(struct AppendBuffer *);
+void abuf_free(struct AppendBuffer *);
+
+int screen_init(struct Screen *, int, int);
+void screen_free(struct Screen *);
+void screen_invalidate(struct Screen *);
+void screen_put(struct Screen *, int, int, char, int, int);
+int screen_puts(struct Screen *, int, int, const char *, int, int, int);
+void screen_clear_row(struct Screen *, int, int);
+int screen_scroll(struct Screen *, struct AppendBuffer *, int, int, int);
+void screen_flush(struct Screen *, struct AppendBuffer *);
+
+#endif
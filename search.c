@@ -0,0 +1,212 @@
+/**
+ * ERU: A simple, lightweight, portable text editor for POSIX systems.
+ *
+ * Copyright (C) 2021, Eric Londo <londoed@comcast.net>, { search.c }.
+ * This software is distributed under the GNU General Public License Version 2.0.
+ * Refer to the file LICENSE for additional details.
+**/
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define SEARCH_X86 1
+#endif
+
+#include "search.h"
+
+static unsigned char
+search_lower(unsigned char c)
+{
+	return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+static unsigned char
+search_upper(unsigned char c)
+{
+	return (c >= 'a' && c <= 'z') ? c - ('a' - 'A') : c;
+}
+
+int
+search_compile(struct Search *s, const char *query, size_t len, int flags)
+{
+	size_t i;
+
+	memset(s, 0, sizeof(struct Search));
+
+	if ((s->pat = malloc(len + 1)) == NULL)
+		return -1;
+
+	s->len = len;
+	s->flags = flags;
+
+	for (i = 0; i < len; i++)
+		s->pat[i] = (flags & SEARCH_ICASE) ? search_lower(query[i]) : query[i];
+
+	for (i = 0; i < 256; i++)
+		s->shift[i] = len;
+
+	for (i = 0; i + 1 < len; i++) {
+		s->shift[s->pat[i]] = len - 1 - i;
+
+		if (flags & SEARCH_ICASE)
+			s->shift[search_upper(s->pat[i])] = len - 1 - i;
+	}
+
+	return 0;
+}
+
+void
+search_free(struct Search *s)
+{
+	free(s->pat);
+	s->pat = NULL;
+}
+
+static int
+search_equal(const struct Search *s, const unsigned char *p)
+{
+	size_t i;
+
+	if (!(s->flags & SEARCH_ICASE))
+		return memcmp(p, s->pat, s->len) == 0;
+
+	for (i = 0; i < s->len; i++) {
+		if (search_lower(p[i]) != s->pat[i])
+			return 0;
+	}
+
+	return 1;
+}
+
+static const char *
+search_horspool(const struct Search *s, const char *buf, size_t n)
+{
+	const unsigned char *b = (const unsigned char *)buf;
+	unsigned char last = s->pat[s->len - 1];
+	size_t i = 0;
+
+	while (i + s->len <= n) {
+		unsigned char c = b[i + s->len - 1];
+
+		if (((s->flags & SEARCH_ICASE) ? search_lower(c) : c) == last && search_equal(s, b + i))
+			return buf + i;
+
+		i += s->shift[c];
+	}
+
+	return NULL;
+}
+
+#ifdef SEARCH_X86
+/**
+ * Load the window at every start position and the one len - 1 bytes on,
+ * and keep only starts where both the first and the last byte of the
+ * query fit. Few survive, and only those are compared in full.
+**/
+static const char *
+search_sse2(const struct Search *s, const char *buf, size_t n)
+{
+	size_t last = s->len - 1, i;
+	const __m128i f_lo = _mm_set1_epi8(s->pat[0]);
+	const __m128i f_up = _mm_set1_epi8(search_upper(s->pat[0]));
+	const __m128i l_lo = _mm_set1_epi8(s->pat[last]);
+	const __m128i l_up = _mm_set1_epi8(search_upper(s->pat[last]));
+	int icase = (s->flags & SEARCH_ICASE) != 0;
+
+	for (i = 0; i + last + 16 <= n; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(buf + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(buf + i + last));
+		__m128i fa = _mm_cmpeq_epi8(a, f_lo);
+		__m128i lb = _mm_cmpeq_epi8(b, l_lo);
+
+		if (icase) {
+			fa = _mm_or_si128(fa, _mm_cmpeq_epi8(a, f_up));
+			lb = _mm_or_si128(lb, _mm_cmpeq_epi8(b, l_up));
+		}
+
+		unsigned int mask = _mm_movemask_epi8(_mm_and_si128(fa, lb));
+
+		while (mask) {
+			size_t at = i + __builtin_ctz(mask);
+
+			if (search_equal(s, (const unsigned char *)buf + at))
+				return buf + at;
+
+			mask &= mask - 1;
+		}
+	}
+
+	return search_horspool(s, buf + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static const char *
+search_avx2(const struct Search *s, const char *buf, size_t n)
+{
+	size_t last = s->len - 1, i;
+	const __m256i f_lo = _mm256_set1_epi8(s->pat[0]);
+	const __m256i f_up = _mm256_set1_epi8(search_upper(s->pat[0]));
+	const __m256i l_lo = _mm256_set1_epi8(s->pat[last]);
+	const __m256i l_up = _mm256_set1_epi8(search_upper(s->pat[last]));
+	int icase = (s->flags & SEARCH_ICASE) != 0;
+
+	for (i = 0; i + last + 32 <= n; i += 32) {
+		__m256i a = _mm256_loadu_si256((const __m256i *)(buf + i));
+		__m256i b = _mm256_loadu_si256((const __m256i *)(buf + i + last));
+		__m256i fa = _mm256_cmpeq_epi8(a, f_lo);
+		__m256i lb = _mm256_cmpeq_epi8(b, l_lo);
+
+		if (icase) {
+			fa = _mm256_or_si256(fa, _mm256_cmpeq_epi8(a, f_up));
+			lb = _mm256_or_si256(lb, _mm256_cmpeq_epi8(b, l_up));
+		}
+
+		unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(fa, lb));
+
+		while (mask) {
+			size_t at = i + __builtin_ctz(mask);
+
+			if (search_equal(s, (const unsigned char *)buf + at))
+				return buf + at;
+
+			mask &= mask - 1;
+		}
+	}
+
+	return search_sse2(s, buf + i, n - i);
+}
+#endif
+
+/**
+ * Whether the query matches at the start of the n bytes at p.
+**/
+int
+search_at(const struct Search *s, const char *p, size_t n)
+{
+	return n >= s->len && search_equal(s, (const unsigned char *)p);
+}
+
+/**
+ * First match of the query in the n bytes at buf, or NULL. An empty query
+ * matches at buf, as with strstr().
+**/
+const char *
+search_find(const struct Search *s, const char *buf, size_t n)
+{
+	if (s->len == 0)
+		return buf;
+
+	if (n < s->len)
+		return NULL;
+
+#ifdef SEARCH_X86
+	if (__builtin_cpu_supports("avx2"))
+		return search_avx2(s, buf, n);
+
+	return search_sse2(s, buf, n);
+#else
+	return search_horspool(s, buf, n);
+#endif
+}
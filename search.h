@@ -0,0 +1,33 @@
+/**
+ * ERU: A simple, lightweight, portable text editor for POSIX systems.
+ *
+ * Copyright (C) 2021, Eric Londo <londoed@comcast.net>, { search.h }.
+ * This software is distributed under the GNU General Public License Version 2.0.
+ * Refer to the file LICENSE for additional details.
+**/
+
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stddef.h>
+
+#define SEARCH_ICASE (1 << 0)
+
+/**
+ * A query compiled for search_find(). With SEARCH_ICASE the pattern is
+ * kept in lower case and ASCII letters match in either case. shift is the
+ * Horspool table for the stretches the vector filter doesn't cover.
+**/
+struct Search {
+	unsigned char *pat;
+	size_t len;
+	int flags;
+	size_t shift[256];
+};
+
+int search_compile(struct Search *, const char *, size_t, int);
+const char *search_find(const struct Search *, const char *, size_t);
+int search_at(const struct Search *, const char *, size_t);
+void search_free(struct Search *);
+
+#endif